@@ -1,349 +1,5011 @@
-/**
- * Semaphores and Shared Memory
- * Written by - Ryan Seys
- * Date - October 13, 2012
- * There is no deadlock in this application. I have implemented such a solution that I believe will result in no dead lock under regular conditions.
- * The execution order is as follows:
- * - Create 6 semaphores, 1 for each of the 5 files (each initialized to 1), and 1 "critical semaphore" to restrict file access to 4 processes at a time (it is initialized to 4)
- * - Create 5 integers in shared memory, initialize them all as zero (files are free, not busy)
- * - Create 5 child process and each do this:
- *   - Acquire preliminary access to even getting to the files through the "critical semaphore"
- *   - Acquire access to the first database that this process needs through the semaphore associated with that resource
- *   - Acquire access to the second database that this process needs through the semaphore associated with that resource
- *   - Once acquired all three of these things, write a 1 to the shared memory for both of the resources (to say file busy)
- *   - Open the file, write to the file, wait a second to simulate some more operations on the file, and close the file.
- *   - Write a zero to the shared memory locations for both of the resources (to say the file is no longer busy)
- *   - Release all semaphores acquired at the beginning of the transaction.
- *   - exit(0) back to the main function
- * - The main function will then clean up shared memory and semaphores and exit appropriately once all 5 child processes have finished executing.
-*/
-
-#include <stdio.h>
-#include <iostream>
-#include <fstream>
-#include <sys/ipc.h>
-#include <sys/types.h>
-#include <sys/sem.h>
-#include <sys/wait.h>
-#include <sys/shm.h>
-#include <unistd.h>
-
-using namespace std;
-
-#define SEM_MODE 0644 /* rw-r--r-- */
-#define SHM_MODE 0666 /* rw-rw-rw- */
-
-/*This declaration is *MISSING* in many Unix environments.
- *It should be in the  file but often is not! If you
- *receive a duplicate definition error for semun then comment out
- *the union definition.
- */
-
-union semun
-{
-  int val;
-  struct semid_ds *buf;
-  ushort  *array;
-  struct seminfo *__buf;
-};
-
-// prototypes
-void open_and_write(int, int **, int);
-void print_sem_val(int, int);
-void init_sem(int, int, int);
-void acquire_resource(int, int);
-void release_resource(int, int);
-int create_shared_mem_id();
-int destroy_mem_segment(int);
-int create_semaphore_set(int);
-int * get_pointer_to_mem(int);
-
-// When this debug flag is set to true,
-// it will print out extra console messages
-// regarding the low level actions that occur
-// in the system with shared memory and semaphores
-bool debug = false;
-
-int main() {
-  int PROC_COUNT = 5;
-  int * shm_ary[5]; //array of pointers to shared mem sections
-  int shmIds[5];
-  int pid;
-
-
-  if(debug) cout << "Parent process started" << endl;
-
-  //create 5 semaphores (1 per file)
-  //create a 6th semaphore to solve problem of deadlock if any would have occurred
-  int semSet = create_semaphore_set(6);
-  if(debug) cout << "Created semaphore set: " << semSet << endl;
-
-  //initialize the first 5 semaphores to 1
-  for(int sem = 0; sem < 5; sem++) {
-    init_sem(semSet, sem, 1);
-
-    int id; //pointer to address
-    if((id = create_shared_mem_id()) != -1) {
-      shmIds[sem] = id;
-      shm_ary[sem] = get_pointer_to_mem(id);
-      *shm_ary[sem] = 0; //store 0 as the initial value
-      if(debug) cout << "Added shared mem " << id << " to shm_ary[" << sem << "]" << endl;
-    }
-    else {
-      cout << "Failed getting shared memory" << endl;
-      exit(-1);
-    }
-  }
-
-  // initialize the 6th semaphore to a value of 4 so that only 4 processes
-  // have access to the 5 files at once. This will eliminate any
-  // deadlock that could occur if all 5 processes had hold of one file
-  // and was waiting for their other file to become free
-  init_sem(semSet, 5, 4);
-
-  for(int i=0; i < PROC_COUNT; i++) {
-    pid = fork();
-    if(pid < 0) {
-      fprintf(stderr, "Fork Failed");
-      exit(-1);
-    }
-    if (pid == 0) { /* child process */
-      if(debug) cout << "Running child process " << getpid() << endl;
-      open_and_write(semSet,shm_ary,i);
-      exit(0);
-    }
-    else { /* parent process */
-      continue;
-    }
-  }
-  if(debug) cout << "Parent waiting for children to all finish" << endl;
-  int j; // will hold the value of the pid of the finished child process
-  while((j = wait(NULL)) != -1) {
-    if(debug) cout << "Child " << j << " finished" << endl;
-  }
-
-  // Cleanup (destroy) all 5 shared memory segments
-  for(int i = 0; i < 5; i++) {
-    if(destroy_mem_segment(shmIds[i]) != -1) {
-      if(debug) cout << "Deleted memory segment with ID " << shmIds[i] << endl;
-    }
-    else {
-      cout << "Error occurred destroying memory segment" << endl;
-    }
-  }
-
-  // Remove all semaphores in the set of semaphores
-  // (start at index 0 and remove all from then on)
-  int semId;
-  if(semId = (semctl(semSet, 0, IPC_RMID, 0)) == -1){
-    perror("Semaphore was not removed.\n");
-  }
-  else{
-    if(debug) cout << "Semaphores were removed succesfully" << endl;
-  }
-
-  // Done!
-  if(debug) cout << "Parent process finished" << endl;
-  exit(0);
-}
-
-// Opens a file, after acquiring the semaphore with that particular resource,
-// then write to shared memory to doubly represent that the file is use
-// This shared memory could later be used as a monitor for the access status
-// of the file. (1 = used, 0 = free). After writing to memory, it will write to the files,
-// and rewrite the shared memory to 0 (free), then release the semaphore to show the resource
-// is now free for another process to use.
-void open_and_write(int semSet, int ** shm_ary, int i) {
-  //calculate the values of the resources required
-  int sem1 = i;
-  int sem2 = (i + 1 == 5) ? 0 : i + 1;
-
-  ofstream db1;
-  ofstream db2;
-  const char * db1filename;
-  const char * db2filename;
-  const char * systemName;
-
-  // Acquire the required resources to do the database transaction
-  acquire_resource(semSet, 5); // get to be one of the four processes that can access files
-  acquire_resource(semSet, sem1); //get access to database 1
-  acquire_resource(semSet, sem2); // get access to database 2
-
-  //Ensure that the shared memory values are set to the
-  //
-  if(*shm_ary[sem1] == 0) {
-    if(debug) cout << "Writing 1 to shared memory space for resource " << sem1 << " (now busy)" << endl;
-    *shm_ary[sem1] = 1; // write a 1 to show that the file is busy
-  }
-  else {
-    cout << "ERROR: Resources are in use!" << endl;
-    exit(-1);
-  }
-  if(*shm_ary[sem2] == 0) {
-    if(debug) cout << "Writing 1 to shared memory space for resource " << sem2 << " (now busy)" << endl;
-    *shm_ary[sem2] = 1; // write a 1 to show that the file is busy
-  }
-  else {
-    cout << "ERROR: Resources are in use!" << endl;
-    exit(-1);
-  }
-  //Switch through all the different systems and the databases they need
-  switch(i) {
-    //Courses System
-    case 0:
-      systemName = "Courses System";
-      db1filename = "faculty.txt";
-      db2filename = "students.txt";
-    break;
-    //GPA Computation System
-    case 1:
-      systemName = "GPA Computation System";
-      db1filename = "students.txt";
-      db2filename = "statistics.txt";
-    break;
-    //University Stats System
-    case 2:
-      systemName = "University Statistics System";
-      db1filename = "statistics.txt";
-      db2filename = "staff.txt";
-    break;
-    //Staff Management System
-    case 3:
-      systemName = "Staff Management System";
-      db1filename = "staff.txt";
-      db2filename = "salary.txt";
-    break;
-    //Faculty Payroll System
-    case 4:
-      systemName = "Faculty Payroll System";
-      db1filename = "salary.txt";
-      db2filename = "faculty.txt";
-    break;
-  }
-
-  // open files once we have acquired both semaphores
-  db1.open(db1filename, ofstream::out | ofstream::app);
-  db2.open(db2filename, ofstream::out | ofstream::app);
-
-  // do all work with databases in here while you have access
-  cout << systemName << " (pid: " << getpid() << ") writing to " << db1filename << endl;
-  db1 << "Being used by " << systemName << " (pid:" << getpid()  << ")" << endl;
-  sleep(1); // sleep 1 second to simulate database action
-  cout << systemName << " (pid: " << getpid() << ") writing to " << db2filename << endl;
-  db2 << "Being used by " << systemName << " (pid:" << getpid()  << ")" << endl;
-  sleep(1); // sleep 1 second to simulate database action
-  db1 << "Free from the " << systemName << " (pid: " << getpid()  << ")" << endl;
-  db2 << "Free from the " << systemName << " (pid: " << getpid()  << ")" << endl;
-
-  //close resource, rewrite shared memory to 0, and release resource from semaphore
-  db1.close();
-  if(debug) cout << "Writing 0 to shared memory space for resource " << sem1 << " (now free)" << endl;
-  *shm_ary[sem1] = 0; //set shared memory to 0 to show that that resource is available now
-  release_resource(semSet, sem1); //release semaphore so another process can acquire it
-  cout << systemName << " (pid: " << getpid() << ") freed up access to " << db1filename << endl;
-
-  db2.close();
-  if(debug) cout << "Writing 0 to shared memory space for resource " << sem2 << " (now free)" << endl;
-  *shm_ary[sem2] = 0; //set shared memory to 0 to show that that resource is available now
-  release_resource(semSet, sem2); //release semaphore so another process can acquire it
-  cout << systemName << " (pid: " << getpid() << ") freed up access to " << db2filename << endl;
-  release_resource(semSet, 5);
-}
-
-// Prints out the value of a semaphore to the standard output
-void print_sem_val(int semSet, int semid) {
-  int semVal = semctl(semSet, semid, GETVAL, 0);
-  cout << "Semaphore " << semid << " value: " << semVal << endl;
-}
-
-// Initialize a semaphore with an integer value
-// In the case of this application we set the value
-// of the semaphore to 1 (for a binary semaphore)
-void init_sem(int semSet, int semid, int value) {
-  union semun sem_init;
-  sem_init.val = value;
-  semctl(semSet, semid, SETVAL, sem_init);
-}
-
-// Acquire the semaphore and print out its value
-// This essentially decreases the value of the semaphore by 1
-void acquire_resource(int semSet, int semid) {
-  if(debug) {
-    cout << "Acquiring semaphore " << semid << endl;
-    print_sem_val(semSet, semid);
-  }
-
-  struct sembuf sem;
-  sem.sem_num = semid;
-  sem.sem_flg = SEM_UNDO;
-  sem.sem_op = -1;
-  semop(semSet,&sem,1);
-
-  if(debug) {
-    cout << "Semaphore " << semid << " acquired!" << endl;
-    print_sem_val(semSet, semid);
-  }
-}
-
-// Release the semaphore and print out its value
-// This essentially increase the value of the semaphore by 1
-void release_resource(int semSet, int semid) {
-  if(debug) {
-    cout << "Releasing semaphore " << semid << endl;
-    print_sem_val(semSet, semid);
-  }
-  struct sembuf sem;
-  sem.sem_num = semid;
-  sem.sem_flg = SEM_UNDO;
-  sem.sem_op = 1;
-  semop(semSet,&sem,1);
-  if(debug) {
-    cout << "Semaphore " << semid << " released!" << endl;
-    print_sem_val(semSet, semid);
-  }
-}
-
-// Returns the id of the shared memory space
-// Use get_pointer_to_mem to get a memory address
-int create_shared_mem_id() {
-  int shmId;
-  if((shmId = shmget(IPC_PRIVATE, sizeof(int),SHM_MODE)) == -1) {
-    perror("shmget error");
-    return -1;
-  }
-  else {
-    if(debug) cout << "Shared memory created with id: " << shmId << endl;
-    return shmId;
-  }
-}
-
-// Attaches shared memory id to a physical address
-// Must pass in the shared memory id
-int * get_pointer_to_mem(int shmId) {
-  int * sharedVar;
-  sharedVar = (int *) shmat(shmId,0,0);
-  if(sharedVar == (int *) -1) {
-    perror("shmat error");
-    return NULL;
-  }
-  else {
-    if(debug) cout << "Starting address of shared variable is: " << sharedVar << endl;
-    return sharedVar;
-  }
-}
-
-// Frees the memory segment associated with that shared memory ID
-// This allows this memory to be re-allocated to other processes later
-int destroy_mem_segment(int shmId) {
-  if(shmctl(shmId,IPC_RMID, (struct shmid_ds *) 0 ) < 0) {
-    perror("can't destroy segment");
-    return -1;
-  }
-  return 0;
-}
-
-// Creates a set of semaphores of a size of the integer passed
-// In this example we pass it a value of 5 to create 5 semaphores
-int create_semaphore_set(int num_of_sems) {
-  return semget(IPC_PRIVATE, num_of_sems, IPC_CREAT | SEM_MODE);
-}
+/**
+ * Semaphores and Shared Memory
+ * Written by - Ryan Seys
+ * Date - October 13, 2012
+ * There is no deadlock in this application. I have implemented such a solution that I believe will result in no dead lock under regular conditions.
+ * The execution order is as follows:
+ * - Create 6 semaphores, 1 for each of the 5 files (each initialized to 1), and 1 "critical semaphore" to restrict file access to 4 processes at a time (it is initialized to 4)
+ * - Create a 7th semaphore (initialized to 1) guarding the transaction queue, which is only used in pool mode (--schedule)
+ * - Create 5 integers in shared memory, initialize them all as zero (files are free, not busy)
+ * - Create 5 child process and each do this:
+ *   - Acquire preliminary access to even getting to the files through the "critical semaphore"
+ *   - Acquire access to the first database that this process needs through the semaphore associated with that resource
+ *   - Acquire access to the second database that this process needs through the semaphore associated with that resource
+ *   - Once acquired each database, write the system number (plus 1) to the shared memory for that resource (to say file busy, and by whom)
+ *   - Open the file, write to the file, wait a second to simulate some more operations on the file, and close the file.
+ *   - Write a zero to the shared memory locations for both of the resources (to say the file is no longer busy)
+ *   - Release all semaphores acquired at the beginning of the transaction.
+ *   - exit(0) back to the main function
+ * - The main function will then clean up shared memory and semaphores and exit appropriately once all 5 child processes have finished executing.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <stdint.h>
+#include <cinttypes>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <time.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/ipc.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <spawn.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <sys/types.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <linux/futex.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SEM_MODE 0644 /* rw-r--r-- */
+#define SHM_MODE 0666 /* rw-rw-rw- */
+#define DB_COUNT 5 /* number of databases, and of systems using them */
+#define ADMISSION_SEM 5 /* the "critical semaphore" that admits 4 processes */
+#define QUEUE_SEM 6 /* guards the transaction queue of the pool mode */
+#define SEM_COUNT 7
+#define MAX_PARTITIONS 8 /* of a database, see partition_count */
+
+/*This declaration is *MISSING* in many Unix environments.
+ *It should be in the  file but often is not! If you
+ *receive a duplicate definition error for semun then comment out
+ *the union definition.
+ */
+
+union semun
+{
+  int val;
+  struct semid_ds *buf;
+  ushort  *array;
+  struct seminfo *__buf;
+};
+
+// prototypes
+void parse_options(int, char **);
+void print_usage(const char *);
+int open_and_write(int, int **, int);
+int run_transaction(int, int **, int);
+void write_record(int, int, const char *, int);
+void append_record(ofstream &, int, int, const char *, const char *, const char *);
+void simulate_work();
+bool acquire_tracked(int, int **, int, int);
+void claim_resource(int **, int, int);
+void record_blocked(int, int, int, double);
+void print_blocked_by();
+void write_metrics(const char *);
+const char * holder_name(int);
+const char * resource_name(int);
+void run_worker(int, int **, int);
+void open_perf_counters(int *, int *);
+void read_perf_counters(int *, int *, struct worker_slot *);
+void print_bench_report(struct worker_slot *, double);
+double now_seconds();
+uint64_t now_ns();
+void throttle_write(int, size_t);
+void take_tokens(uint64_t *, double, double, uint64_t *);
+size_t record_size(const char *, const char *, const char *);
+void print_throttling();
+long fill_queue();
+uint64_t txn_deadline(long);
+long take_transaction(int, int **, bool, int);
+bool shares_database(int, int);
+void try_prefetch(int, int **);
+bool take_prefetched(int);
+void finish_transaction(long, uint64_t);
+void print_schedule_report();
+bool admit(int, int);
+bool drop_oldest_waiter();
+bool codel_should_shed(uint64_t);
+void codel_update(uint64_t, uint64_t);
+void print_admission_report();
+void init_versions();
+void publish_versions(int, int, const char *);
+int pick_version_slot(int);
+bool read_snapshot(int, uint64_t, struct db_version *);
+void run_reader(int);
+void print_reader_report();
+long count_records(const char *);
+void setup_shared_state(int **, bool);
+void * shared_alloc(size_t);
+pid_t spawn_worker(int, char **, int, int, int);
+void init_all_sems(int, unsigned short *);
+void maybe_seal(int);
+long first_free_segment(const char *);
+string segment_name(const char *, long, bool);
+void run_compressor();
+bool compress_segment(const char *, const char *);
+size_t lz_compress(const uint8_t *, size_t, uint8_t *);
+long lz_decompress(const uint8_t *, size_t, uint8_t *, size_t);
+bool read_segment(const char *, string &);
+bool read_lz_range(const char *, uint64_t, uint64_t, string &);
+bool cat_segments(const char *, uint64_t, uint64_t);
+bool read_database(const char *, uint64_t, uint64_t, string &);
+bool run_lz_bench(const char *);
+bool read_memory_usage(const char *, struct memory_usage *);
+int logged_semop(int, struct sembuf *, int);
+void log_grant(int, uint64_t);
+long next_replay_event();
+bool wait_for_turn(uint64_t);
+void abandon_replay(uint64_t);
+bool load_grant_log(const char *);
+void write_grant_log(const char *);
+void print_replay_report();
+long queued_count();
+bool make_trace(const char *);
+int system_index(const string &);
+bool load_trace(const char *);
+int db_lock_ops(int, int, int, int, struct sembuf *);
+void acquire_split(int, int **, int, int);
+void release_database(int, int);
+void print_split_report();
+void acquire_file_lock(int **, int, int);
+void release_file_lock(int);
+uint64_t reserve_tail(int, size_t, uint64_t *);
+void write_staged(int, const char *, size_t, uint64_t);
+void publish_staged(int, uint64_t, uint64_t);
+void check_high_water(int);
+bool map_batch(const char *);
+bool write_batch(const char *, long);
+void ingest_batch(int, int **, struct worker_slot *);
+int parse_chunk(uint64_t, uint64_t *, uint64_t, struct trace_entry *, int);
+void print_ingest_report(double);
+void pool_admit(int);
+void pool_release();
+long take_tokens(long *, long);
+void return_tokens(long);
+void leave_admission(int);
+void print_pool_report();
+bool single_due();
+int append_single(int);
+bool audit_databases();
+void enter_parallel();
+void leave_parallel(int);
+int max_concurrency();
+void print_parallelism_report(double);
+void wheel_link(int, int);
+void wheel_unlink(int);
+void wheel_place(int);
+void arm_timer(long);
+void cancel_timer();
+bool timer_expired();
+void advance_wheel();
+void run_ticker();
+bool timed_acquire(int, int);
+void back_off(int);
+void wake_waiter(int);
+bool read_due();
+int read_transaction(int, int **, int);
+int pick_replica(int);
+int replica_fd(int, int);
+bool read_last_record(int, char *, uint64_t);
+void take_replica_tickets(int, uint64_t *);
+void replicate(int, int, uint64_t *);
+string replica_name(int, int);
+bool seed_replicas();
+void print_replica_report();
+bool parse_partition_dirs(char *);
+string partition_path(int, int);
+int partition_of(int);
+void acquire_partitions(int, int);
+void measure_partitions(uint64_t [][MAX_PARTITIONS]);
+void print_partition_report(double);
+bool event_acquire(int, int, bool);
+void notify_waiter(int);
+void post_event(int);
+void wait_for_events();
+void open_event_loop();
+void print_event_report();
+void run_watcher();
+void slot_waiting();
+void slot_running();
+void print_wheel_report();
+void spin_lock(bool *);
+void spin_unlock(bool *);
+void print_sem_val(int, int);
+void init_sem(int, int, int);
+void acquire_resource(int, int);
+void release_resource(int, int);
+int create_shared_mem_id(size_t);
+int destroy_mem_segment(int);
+int create_semaphore_set(int);
+int * get_pointer_to_mem(int);
+
+// When this debug flag is set to true,
+// it will print out extra console messages
+// regarding the low level actions that occur
+// in the system with shared memory and semaphores
+bool debug = false;
+
+// When this flag is set to true, each child process runs the
+// compile-time specialized kernel for its system (see fixed_kernel)
+// instead of the runtime-configured open_and_write
+bool fixed_topology = false;
+
+// Number of worker processes, and how many transactions each one runs.
+// Worker i runs the transactions of system i % DB_COUNT.
+int worker_count = 5;
+int txn_count = 1;
+
+// How long a transaction holds its databases to simulate the
+// database action, between each of its two writes (-1 = default)
+long work_usec = -1;
+
+// Benchmark mode: measure throughput and hardware performance counters
+// per worker around the transaction loop, then print a report
+bool bench = false;
+
+// When set, the per transaction console messages are not printed
+bool quiet = false;
+
+#define MAX_WORKERS 1024
+#define MAX_TRANSACTIONS 1000000 /* per worker */
+
+// Performance counters opened in each worker in benchmark mode.
+// When the hardware event is not available (eg. in a virtual machine,
+// or with perf_event_paranoid too high) the software fallback is used,
+// and a counter with no fallback is reported as unavailable.
+enum {
+  PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES,
+  PERF_CONTEXT_SWITCHES, PERF_PAGE_FAULTS, PERF_COUNTERS
+};
+
+struct perf_counter_desc {
+  const char * name;
+  uint32_t type;
+  uint64_t config;
+  const char * fallback_name;
+  uint32_t fallback_type;
+  uint64_t fallback_config;
+};
+
+const perf_counter_desc perf_counters[PERF_COUNTERS] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+    "task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, NULL, 0, 0 },
+  { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, NULL, 0, 0 },
+  { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, NULL, 0, 0 },
+  { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, NULL, 0, 0 }
+};
+
+// Blocked-by matrices: how long each system spent waiting behind each other
+// system (the holder, read from the ownership word of the database it was
+// waiting for), and on which resource. Filled in by the workers whenever an
+// acquire has to block, printed and exported by the parent at shutdown.
+#define UNKNOWN_HOLDER DB_COUNT /* holder column when nobody had claimed it yet */
+#define RESOURCE_COUNT (DB_COUNT + 1) /* the databases and the admission semaphore */
+
+struct blocking_stats {
+  uint64_t by_system_ns[DB_COUNT][DB_COUNT + 1];
+  uint64_t by_system_waits[DB_COUNT][DB_COUNT + 1];
+  uint64_t by_resource_ns[DB_COUNT][RESOURCE_COUNT];
+  uint64_t by_resource_waits[DB_COUNT][RESOURCE_COUNT];
+};
+
+struct blocking_stats * blocking = NULL; // in shared memory, set up by main
+
+// Print the blocked-by matrices at shutdown, and/or export them
+// in the textfile format of the node exporter to this file
+bool print_blocking = false;
+const char * metrics_file = NULL;
+
+// I/O rate limits of every database file, in bytes and in writes per second
+// (0 = unlimited). Writers take tokens from the file's buckets before each
+// write, and wait when the buckets are empty. A bucket holds at most
+// RATE_BURST_SEC worth of tokens.
+double rate_bytes = 0;
+double rate_ops = 0;
+#define RATE_BURST_SEC 0.1
+
+// The token buckets of one database file. Each bucket is kept as the time at
+// which it will be full again: taking tokens pushes that time forward by
+// what they are worth at the configured rate, so refilling from the
+// monotonic clock and taking tokens is a single compare and swap, and no
+// lock is added to the write path. Aligned so files do not share a cache line.
+struct alignas(64) file_buckets {
+  uint64_t bytes_full_ns;
+  uint64_t ops_full_ns;
+  uint64_t throttled_ns; // total time writers waited for tokens
+};
+
+struct file_buckets * buckets = NULL; // in shared memory, one per database
+
+// Pool mode: instead of each worker running the transactions of its own
+// system, the parent queues all worker_count * txn_count transactions in
+// shared memory (transaction k is for system k % DB_COUNT, and arrives
+// k * arrival_usec after the start) and the workers take them from the
+// queue in the order chosen by the scheduler:
+// - fifo: the oldest transaction that has arrived
+// - edf: the earliest deadline among the SCHED_WINDOW oldest transactions,
+//   preferring one whose databases are free right now, but never one
+//   without a deadline over one with a deadline. A transaction that
+//   can no longer make its deadline (even if it took no longer than the
+//   quickest transaction so far) is rejected, or deferred to run without
+//   a deadline.
+enum { POLICY_NONE, POLICY_FIFO, POLICY_EDF };
+int schedule = POLICY_NONE;
+long arrival_usec = 0;
+long deadline_ms[DB_COUNT] = { 0 }; // per system, 0 = no deadline
+bool reject_late = false;
+#define SCHED_WINDOW 64
+
+enum { TXN_PENDING, TXN_TAKEN };
+
+struct txn {
+  int system;
+  int state;
+  uint64_t arrival_ns;
+  uint64_t deadline_ns; // 0 = no deadline
+  long hold_usec; // how long it simulates work, -1 = work_usec
+};
+
+struct txn_queue {
+  long count;
+  long head; // every transaction before head has been taken
+  uint64_t service_ns; // quickest time a transaction has taken (0 = none yet)
+  long with_deadline;
+  long met;
+  long missed;
+  long late; // rejected or deferred when taken
+};
+
+struct txn_queue * queue = NULL; // in shared memory, set up by main in pool mode
+struct txn * queued_txns = NULL; // the queue's transactions, also in shared memory
+
+// Workload traces (--make-trace, --trace): one transaction per line,
+// "arrival_usec hold_usec system", where arrival_usec counts from the start
+// and hold_usec means what --work-usec does. --make-trace reconstructs the
+// transactions of the existing database files; the records in them give
+// the systems and the order in which they used each database, but no times,
+// so arrivals are --arrival-usec apart and holds are --work-usec, to be
+// edited as need be. --trace makes the pool queue the trace's transactions
+// instead of k % DB_COUNT ones, with its times divided by --trace-speed.
+struct trace_entry {
+  uint64_t arrival_usec;
+  long hold_usec;
+  int system;
+};
+
+const char * make_trace_file = NULL;
+const char * trace_file = NULL;
+double trace_speed = 1;
+struct trace_entry * trace = NULL; // read by every process
+long trace_count = 0;
+long txn_hold_usec = -1; // of the transaction this worker is running
+
+// Batch ingestion (--ingest FILE): runs every transaction of a batch file,
+// in text (the trace format) or binary (BATCH_MAGIC, then batch_records).
+// The file is memory mapped and cut into INGEST_CHUNK chunks, which the
+// workers claim one at a time from a shared cursor, parse, and run as they
+// go, so the batch is never held in memory as a whole: a text chunk has the
+// lines that start in it, and a binary chunk whole records. Once a worker
+// is done with a chunk it drops its pages from its mapping. Arrival times
+// are ignored, a batch runs as fast as it can. --make-batch N FILE writes
+// a batch of N transactions (binary when FILE ends in .bin).
+struct batch_record {
+  uint64_t arrival_usec;
+  int32_t hold_usec; // -1 = work_usec
+  int32_t system;
+};
+
+#define BATCH_MAGIC "SASBATCH"
+#define BATCH_MAGIC_LEN 8
+#define INGEST_CHUNK (1 << 20)
+#define INGEST_BATCH 256 /* transactions parsed at a time */
+
+struct ingest_state {
+  uint64_t next_chunk;
+  long parsed;
+  long bad; // lines that could not be parsed
+  uint64_t parse_ns; // worker time spent parsing
+};
+
+const char * ingest_file = NULL;
+const char * make_batch_file = NULL;
+long make_batch_count = 0;
+const char * batch_map = NULL; // the batch file, mapped by main
+size_t batch_size = 0;
+size_t batch_start = 0; // past the header
+bool batch_binary = false;
+struct ingest_state * ingest = NULL; // in shared memory, set up by main when ingesting
+
+// Index of this worker process (set in the child), -1 in the parent
+int worker_id = -1;
+
+// Admission control (--admission-queue): at most admission_bound processes
+// may queue for the admission semaphore. When one more arrives, the
+// overflow policy decides who fails fast:
+// - reject: the newcomer
+// - drop-oldest: the process that has been queued the longest
+// - codel: the newcomer, as with reject, and on top of that newcomers are
+//   shed whenever admitted processes have been waiting longer than
+//   codel_target_usec for at least codel_interval_usec, at a rate that
+//   grows while the queueing delay stays above target (as CoDel does)
+// A shed transaction does no work, and its caller gets false from admit.
+enum { OVERFLOW_REJECT, OVERFLOW_DROP_OLDEST, OVERFLOW_CODEL };
+int admission_bound = 0; // 0 = plain blocking admission
+int overflow_policy = OVERFLOW_REJECT;
+long codel_target_usec = 5000;
+long codel_interval_usec = 100000;
+#define ADMISSION_POLL_USEC 10000 /* how often a queued process checks if it was dropped */
+#define DROPPED_TICKET UINT64_MAX
+
+struct admission_state {
+  long waiting; // processes queued for the admission semaphore
+  uint64_t next_ticket;
+  uint64_t tickets[MAX_WORKERS]; // ticket of each queued worker (0 = not queued)
+  bool codel_lock;
+  bool dropping;
+  uint64_t first_above_ns;
+  uint64_t drop_next_ns;
+  long drop_count;
+  long admitted;
+  long shed;
+  uint64_t wait_ns; // total queueing delay of the admitted processes
+  uint64_t max_wait_ns;
+};
+
+struct admission_state * admission = NULL; // in shared memory, set up by main
+
+// Distributed admission (--admission-pools N): instead of every transaction
+// going through the admission semaphore, the 4 admission tokens are spread
+// over N pools, each on a cache line of its own, and a worker takes and
+// gives back tokens through the pool of the CPU it runs on. A pool that runs
+// dry refills with a batch of tokens from the global budget, and one that
+// gets more than two batches gives one back. Only when neither has a token
+// does a worker go further: it takes one from any other pool, or waits. While
+// anyone waits, released tokens go straight back to the global budget and
+// the waiters are woken through a futex on its generation.
+// Tokens are only ever moved, so no more than 4 transactions are admitted
+// at a time, just as with the semaphore.
+#define ADMISSION_TOKENS 4
+#define MAX_ADMISSION_POOLS 64
+int admission_pools = 0; // 0 = the admission semaphore
+long pool_batch = 1; // tokens moved between a pool and the global budget at a time
+
+struct alignas(64) admission_pool {
+  long tokens;
+  long local; // admissions served from this pool
+  long refills; // batches it took from the global budget
+  long steals; // tokens its workers took from other pools
+  long waits;
+  uint64_t wait_ns;
+};
+
+struct admission_budget {
+  alignas(64) long tokens; // not in any pool
+  uint32_t generation; // futex word, bumped when tokens come back for waiters
+  long waiters;
+  long returns; // batches pools gave back
+  struct admission_pool pools[MAX_ADMISSION_POOLS];
+};
+
+struct admission_budget * budget = NULL; // in shared memory, set up by main
+
+// Parallelism report (--parallelism): each transaction holds both of its
+// databases from the moment it has them until it starts releasing them,
+// and only transactions whose systems share no database can do that at the
+// same time. The workers keep track of how many hold their databases at any
+// time, and of how long every database and every worker was busy, so that
+// at shutdown the concurrency achieved can be compared with the most the
+// conflict graph allows and with a lower bound on the makespan.
+bool parallelism = false;
+uint64_t hold_started_ns = 0; // of the transaction this worker runs
+
+struct parallelism_state {
+  bool lock;
+  int active; // transactions holding their databases now
+  int max_active;
+  uint64_t since_ns; // when active last changed
+  uint64_t level_ns[DB_COUNT + 1]; // time spent with that many active
+  long txns[DB_COUNT]; // by system
+  uint64_t hold_ns; // of all the transactions
+  uint64_t db_hold_ns[DB_COUNT]; // of the transactions using each database
+};
+
+struct parallelism_state * parallel = NULL; // in shared memory, set up by main
+
+// Timed acquisitions (--acquire-timeout-usec N): a transaction that has not
+// got both of its databases N microseconds after it started on them gives
+// up on them and on its admission, backs off for a while that doubles with
+// every attempt that fails (from --backoff-usec, with jitter), and tries
+// again. None of these waits keeps a timer of its own: the semaphore waits
+// block without a timeout, and every worker has one timer in a hierarchical
+// timer wheel in shared memory, with WHEEL_LEVELS levels of WHEEL_SLOTS
+// slots whose ticks grow WHEEL_SLOTS times longer per level. Arming or
+// cancelling a timer links it into or out of a slot's list under the
+// wheel's lock, whatever the number of timers. A single ticker process
+// advances the wheel every tick, cascading the timers of the next slot of a
+// level down to the one below it as the level below wraps around, and
+// moves the timers that are due to the expired list. It then wakes all of
+// their workers with a signal in one batch, which interrupts their
+// semop, and keeps doing so every tick until each has cancelled its timer,
+// so that a wakeup that came just before its worker blocked is not lost.
+#define TIMER_TICK_USEC 1000
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 /* 2^24 ticks ahead, over 4 hours */
+#define EXPIRED_LIST (WHEEL_LEVELS * WHEEL_SLOTS)
+long acquire_timeout_usec = 0; // 0 = wait for as long as it takes
+long backoff_usec = 1000;
+#define MAX_BACKOFF_SHIFT 6
+
+struct wheel_timer {
+  int next; // in the list of its slot, -1 at the end
+  int prev;
+  int list; // slot, or EXPIRED_LIST, -1 = not armed
+  pid_t pid;
+  uint64_t expires; // tick
+};
+
+struct timer_wheel {
+  bool lock;
+  uint64_t start_ns; // of tick 0
+  uint64_t tick; // the last one the ticker did
+  int heads[EXPIRED_LIST + 1]; // first timer of each list, -1 = empty
+  long armed;
+  long cancelled; // before they expired
+  long expired;
+  long ticks;
+  long batches; // ticks that woke anyone
+  long wakeups;
+  long max_batch;
+  long timed_out; // acquisitions given up on
+  long backoffs;
+  uint64_t backoff_ns;
+  struct wheel_timer timers[MAX_WORKERS]; // by worker
+};
+
+struct timer_wheel * wheel = NULL; // in shared memory, set up by main
+
+// Read transactions (--read-pct PCT): PCT% of the transactions of a system
+// only read the last record of its first database, and hold it for the
+// simulated work while they do. They take no admission, as one database
+// alone can't be part of a deadlock. By default a read holds the database
+// semaphore like a writer does. With --replicas N every database also has N
+// replica files, <database>.replica<k>, each behind a semaphore of its own,
+// and a read goes to whichever replica has the fewest readers waiting on or
+// holding it (its load counter in shared memory), fewest reads first on a
+// tie, so reads no longer queue behind each other or behind the writers of
+// the database. A writer still holds the database itself, which keeps the
+// writers of a database in one order, and as it commits it takes the next
+// replication ticket of the database. It appends its records to the
+// replicas after releasing the database, one replica at a time and each
+// only once the transaction before it in the database is on it: a replica
+// always holds whole transactions, in the same order as the database, and
+// a writer never holds the database while it waits for the readers of the
+// replicas. The replicas are brought up to the database from scratch at
+// startup.
+#define MAX_REPLICAS 8
+#define REPLICA_SEM(db, k) (SEM_COUNT + (db) * MAX_REPLICAS + (k))
+#define REPLICA_SEM_COUNT (SEM_COUNT + DB_COUNT * MAX_REPLICAS)
+int read_pct = 0;
+int replica_count = 0;
+long reads_seen = 0; // transactions this worker has started
+int replica_fds[DB_COUNT][MAX_REPLICAS]; // of this worker, -1 = not open
+
+struct alignas(64) replica_load {
+  long load; // readers waiting on or holding the replica
+  long reads;
+  uint64_t applied; // replication tickets of the database appended to it
+};
+
+struct replica_state {
+  long primary_reads; // of the databases themselves
+  long stale; // reads that found a transaction half written
+  uint64_t read_wait_ns;
+  long replications;
+  uint64_t next_ticket[DB_COUNT]; // replication tickets, taken while holding the database
+  struct replica_load replicas[DB_COUNT][MAX_REPLICAS];
+};
+
+struct replica_state * reads = NULL; // in shared memory, set up by main
+
+// Partitioned databases (--partitions N): every database is split by key
+// into N partition files, <dir>/<database>.part<p>, with the directories
+// of --partition-dirs (a comma separated list, the working directory by
+// default) taking the partitions in turn, so that the partitions of a
+// database can sit on different devices. Every transaction has a key of
+// its own, its worker and how many transactions the worker has run, and
+// the key hashed with a database picks its partition of that database, so
+// the partitions fill evenly and the two databases of a transaction are
+// often in different partitions. Every partition has a semaphore and an
+// ownership word of its own, so transactions with different keys seldom
+// wait for each other, and a transaction takes the partitions of its two
+// databases, and its admission, in one atomic semop, as the fixed kernels
+// do, so taking two partitions can't deadlock.
+#define MAX_PARTITION_DIRS 16
+#define PARTITION_SEM(db, p) (SEM_COUNT + (db) * MAX_PARTITIONS + (p))
+#define PARTITION_SEM_COUNT (SEM_COUNT + DB_COUNT * MAX_PARTITIONS)
+int partition_count = 0; // 0 = one file per database
+const char * partition_dirs[MAX_PARTITION_DIRS] = { "." };
+int partition_dir_count = 1;
+uint64_t partition_bytes[DB_COUNT][MAX_PARTITIONS]; // in the parent, at startup
+long partition_txns = 0; // transactions of this worker that took partitions
+int held_partition[DB_COUNT] = { -1, -1, -1, -1, -1 }; // of this worker
+
+struct partition_state {
+  int owner[DB_COUNT][MAX_PARTITIONS]; // 0 = free, otherwise 1 + the system using it
+  long transactions;
+  long crossed; // transactions whose databases were in different partitions
+};
+
+struct partition_state * partitions = NULL; // in shared memory, set up by main
+
+// Lock grants as events (--event-grants): every worker has an eventfd,
+// made by the parent before it forks them, and an epoll instance of its
+// own watching it. A worker that finds a semaphore taken, a database, the
+// admission or the queue semaphore, registers itself as waiting for it and
+// waits in epoll_wait instead of in semop, so the same loop could wait for
+// anything else given a file descriptor. The timer wheel uses the eventfd
+// too, instead of a signal. A worker releasing a semaphore hands the grant
+// to the oldest worker waiting for it, by marking it notified and writing
+// to its eventfd; the worker then tries the semaphore again. Someone may
+// have taken it in between, in which case the waiter waits again for that
+// one's release. A waiter that got the semaphore by itself, while a
+// notification was on its way to it, passes that notification on to the
+// next waiter, so none is lost. The admission queue and pools, and the
+// replicas, wait in ways of their own, and can't be used with it.
+enum { GRANT_IDLE, GRANT_WAITING, GRANT_NOTIFIED };
+bool event_grants = false;
+int event_fds[MAX_WORKERS]; // by worker, inherited from the parent
+int event_loop = -1; // epoll instance of this worker
+
+struct grant_waiter {
+  int state;
+  int sem;
+  uint64_t ticket; // the oldest one waiting has the lowest
+};
+
+struct grant_events {
+  long waiting[SEM_COUNT];
+  uint64_t next_ticket;
+  long waits; // acquisitions that had to wait
+  long notified;
+  long passed_on;
+  long wakeups;
+  long retaken; // wakeups that found the semaphore taken again
+  struct grant_waiter waiters[MAX_WORKERS];
+};
+
+struct grant_events * events = NULL; // in shared memory, set up by main
+
+// Snapshot reads (--readers): the latest state of each database (how many
+// records it holds, and its last record) is kept in shared memory as a
+// small ring of versions. A transaction publishes a new version of both of
+// its databases, stamped with one number from the global commit counter,
+// just before it releases them. A reader takes the last fully published
+// commit number as its snapshot and reads, for every database, the newest
+// version no newer than it: no locks are taken, so readers never block the
+// writers or each other. The commit numbers are made visible in order, so a
+// snapshot always sees either both or neither database of a transaction.
+// A writer reuses the oldest version of a database once no snapshot can need
+// it; if a reader has held on to it for too long the version is reused
+// anyway, and the reader notices (from the sequence number of the version)
+// and retries with a new snapshot.
+#define MVCC_VERSIONS 8 /* versions kept per database */
+#define MAX_READERS 64
+#define RECORD_SIZE 96
+
+struct db_version {
+  uint64_t seq; // odd while the version is being written
+  uint64_t commit_ts;
+  bool used;
+  long records;
+  char last_record[RECORD_SIZE];
+};
+
+struct mvcc_store {
+  uint64_t next_ts; // last commit number handed out
+  uint64_t visible_ts; // every commit up to this one has been published
+  long initial_records; // records in all the files at startup
+  uint64_t snapshots[MAX_READERS]; // snapshot of each reader plus 1 (0 = not reading)
+  long reads;
+  long retries;
+  long inconsistent;
+  long forced_reuse; // versions reused while a snapshot could still need them
+  long file_reads; // reads of the files up to their high-water mark (staged writes)
+  long holes; // of those, the ones that found a hole
+  struct db_version versions[DB_COUNT][MVCC_VERSIONS];
+};
+
+int reader_count = 0;
+struct mvcc_store * store = NULL; // in shared memory, set up by main when there are readers
+
+// Pipelined acquisition (--pipeline, pool mode): a worker takes its next
+// transaction off the queue before it runs the current one (the first
+// that has arrived and needs none of the current one's databases, in the
+// order of the schedule), and while the
+// current one is writing it tries to get the next one's admission and
+// database semaphores in a single non-blocking semop. The attempt never
+// waits while holding anything, so it adds no edge to the wait-for graph
+// and cannot deadlock; when it fails the next transaction acquires as
+// usual, once the current one has released everything.
+bool pipeline = false;
+
+struct prefetch_state {
+  int next; // system of the transaction after the one about to start (-1 = none)
+  int system; // system whose semaphores try_prefetch goes after (-1 = none)
+  bool acquired; // and they are held already
+  long hits; // transactions that found their semaphores held
+};
+
+struct prefetch_state prefetch = { -1, -1, false, 0 }; // of this worker process
+
+// Staged writes (--staged-writes): while it holds a database, a transaction
+// only reserves the bytes of its records at the tail of the file, and takes
+// a ticket in the file's reservation order. Once it has released its
+// databases it writes the records it staged into its reservations with
+// pwrite, then waits for the transactions with earlier tickets to have
+// written theirs, and moves the file's high-water mark past its own. The
+// file may have holes past the high-water mark while writes are under way,
+// but never before it, so that is as far as readers look.
+struct alignas(64) file_tail {
+  bool lock; // held while reserving
+  uint64_t reserved; // end of the reserved bytes
+  uint64_t next_ticket;
+  uint64_t done_ticket; // the reservations before this one are written
+  uint64_t high_water; // bytes of the file with no hole in them
+};
+
+bool staged_writes = false;
+struct file_tail * tails = NULL; // in shared memory, one per database
+int staged_fds[DB_COUNT] = { -1, -1, -1, -1, -1 }; // of this worker, opened on first use
+
+// Lock splitting of hot databases (--split-hot PCT). The semaphore of each
+// database holds DB_STRIPES tokens: a whole-file lock takes all of them, and
+// a striped lock takes one, plus the semaphore of its stripe. Whole-file and
+// striped locks exclude each other whatever the mode of the database, so
+// its mode can change at any time, and the transactions holding it keep
+// the locks they took. The key of a record is the system writing it, and
+// its stripe is system % DB_STRIPES, so the workers of a system share a
+// stripe and exclude each other. The records of different stripes may go
+// to the file at the same time, as each one is a single O_APPEND write. Every SPLIT_WINDOW acquisitions of a database, the acquisition
+// completing the window looks at how many of them had to wait: PCT percent
+// or more and the database is split into stripes. Striping is what takes
+// those waits away, so they can't tell when to merge: that goes by the
+// demand instead, which the lock granularity doesn't change. A striped
+// database is merged back into one lock after SPLIT_MERGE_WINDOWS windows
+// in a row that took at least twice as long as the one that split it.
+#define DB_STRIPES 8
+#define SPLIT_WINDOW 32
+#define SPLIT_MERGE_WINDOWS 4
+#define STRIPE_SEM(db, stripe) (SEM_COUNT + (db) * DB_STRIPES + (stripe))
+#define SPLIT_SEM_COUNT (SEM_COUNT + DB_COUNT * DB_STRIPES)
+int split_hot = 0; // percent of acquisitions waiting, 0 = one lock per database
+
+struct split_state {
+  bool striped[DB_COUNT];
+  long window_acquires[DB_COUNT];
+  long window_waits[DB_COUNT];
+  uint64_t window_start_ns[DB_COUNT];
+  uint64_t split_window_ns[DB_COUNT]; // how long the window that split it took
+  int calm_windows[DB_COUNT]; // in a row, while striped
+  long acquires[DB_COUNT];
+  long striped_acquires[DB_COUNT];
+  long splits[DB_COUNT];
+  long merges[DB_COUNT];
+};
+
+struct split_state * split = NULL; // in shared memory, set up by main when splitting
+int held_stripe[DB_COUNT] = { -1, -1, -1, -1, -1 }; // of this worker, -1 = the whole file
+
+// Lock backend of the databases (--locks). By default (sysv) a database is
+// locked through its semaphore. With ofd it is locked through the kernel's
+// open file description locks (F_OFD_SETLKW) on the database file itself,
+// which other tools see and respect too: a write lock on the whole file.
+// With ofd-record only the record key of the writer is locked, the byte at
+// OFD_KEY_BASE + system (past anything a database will hold): the workers
+// of a system exclude each other, the two systems sharing a database may
+// append at the same time, and a tool that locks the whole file still
+// excludes them all. The two databases of a
+// transaction are locked in database order, as file locks get none of the
+// admission semaphore's deadlock avoidance from other tools. The admission
+// and queue semaphores are used as with sysv.
+enum { LOCKS_SYSV, LOCKS_OFD, LOCKS_OFD_RECORD };
+int lock_backend = LOCKS_SYSV;
+#define OFD_KEY_BASE (1LL << 40)
+int lock_fds[DB_COUNT] = { -1, -1, -1, -1, -1 }; // of this worker, while it holds the database
+
+// Schedule recording and replay (--record FILE, --replay FILE). Every semop
+// through which a worker is granted or releases semaphores goes through
+// logged_semop. When recording, each one takes the next number of a shared
+// sequence counter and is logged under it, as (worker, acquire or release,
+// semaphores); a release is logged just before it happens and a grant just
+// after, so that a release always comes before the grants it allowed. The
+// log is written to FILE at shutdown, one grant per line.
+//
+// When replaying, the counter says whose turn it is: a worker waits until
+// the counter reaches the number of its own next grant in the log, makes
+// it, and moves the counter on, so the grants happen in the recorded order.
+// A non-blocking attempt that is not the worker's next grant fails as it
+// did when recorded. If a worker's grants stop matching the log (or no
+// grant happens for too long), the replay is abandoned and everyone goes on
+// unordered, rather than waiting forever.
+const char * record_file = NULL;
+const char * replay_file = NULL;
+#define GRANT_LOG_PER_TXN 16 /* room in the log per transaction */
+
+struct grant_event {
+  int worker;
+  int release; // 1 when the semaphores are released, 0 when granted
+  uint64_t sems; // bit i set for semaphore i
+};
+
+struct grant_log {
+  uint64_t next_seq; // recording: the next sequence number, replaying: whose turn it is
+  bool abandoned;
+  uint64_t abandoned_at;
+  uint64_t capacity;
+};
+
+struct grant_log * grants = NULL; // in shared memory, set up by main when recording or replaying
+struct grant_event * logged_grants = NULL; // also in shared memory, when recording, by sequence number
+
+// The schedule being replayed, by sequence number (read by every process)
+struct grant_event * replay_events = NULL;
+uint64_t replay_count = 0;
+uint64_t replay_cursor = 0; // this worker's next grant is at or after this one
+
+// Fast startup (--fast-start): the semaphores are initialized with one
+// SETALL, and all the shared state is carved out of a single segment
+// instead of getting one segment (and one shmget and shmat) per piece.
+// With --spawn the workers are started with posix_spawn rather than fork.
+bool fast_start = false;
+bool spawn_workers = false;
+
+// Lean fork (--lean-fork): a forked worker shares the parent's pages until
+// it writes to them, and then gets a copy of every page it wrote. In this
+// mode the parent flushes its buffers before forking, and the workers write
+// their records with write(2) from the stack rather than through ofstream
+// (whose buffers and locale reference counts are on pages of the parent),
+// so each worker copies as few pages as it can. Memory per worker is in the
+// benchmark report.
+bool lean_fork = false;
+bool measuring = false; // sizing the single segment, see shared_alloc
+char * arena = NULL; // the single segment
+size_t arena_used = 0;
+vector<int> segment_ids; // every segment, for the cleanup
+
+// Set from --worker-of in a worker started with posix_spawn
+int spawned_worker = -1;
+int spawned_semset = -1;
+int spawned_arena = -1;
+
+// How long it takes from launching the program until the first transaction
+// starts, and until every worker is running. The parent also sets
+// workers_done once they have all exited, for the helper processes.
+struct startup_times {
+  uint64_t launched_ns;
+  uint64_t first_txn_ns;
+  uint64_t all_ready_ns;
+  long ready;
+  bool workers_done;
+};
+
+struct startup_times * startup = NULL; // in shared memory, set up by main
+bool started_txn = false; // this worker has started its first transaction
+
+// Single-record transactions (--single-pct PCT): PCT% of the transactions
+// only append one record to the first database of their system, and they
+// take no semaphore at all. The record is formatted once per worker and goes
+// out in one write to a file opened with O_APPEND, which the kernel makes
+// atomic for a regular file: the end of file is found and moved past the
+// record in the same step as the write, so records never interleave, even
+// with a locked transaction's. Records are well below PIPE_BUF, so they also
+// stay whole on filesystems that only promise that much. --audit checks the
+// files afterwards.
+int single_pct = 0;
+long single_seen = 0; // transactions this worker has started
+long appended_txns = 0; // and how many of them were single-record
+int append_fds[DB_COUNT] = { -1, -1, -1, -1, -1 };
+char single_records[DB_COUNT][RECORD_SIZE]; // of this worker, by system
+int single_lens[DB_COUNT];
+bool audit = false;
+bool allow_overlap = false; // the run used striped or record locks (--allow-overlap)
+
+// Sealed segments (--seal-bytes): once a database file has grown past
+// seal_bytes, the transaction that last wrote to it seals it, while still
+// holding its semaphore, by renaming it to the next segment name
+// (eg. faculty.txt.3), and the next transaction starts a new file.
+// A background compressor process turns every sealed segment into a block
+// compressed one (faculty.txt.3.lz) and removes the original. The tools
+// (--cat) read all the segments and the open file as one database.
+//
+// A compressed segment holds LZ_BLOCK_SIZE blocks compressed each on their
+// own, with a dependency-free LZ77 compressor (in the style of LZ4), and an
+// index of where every block starts, so any range of it can be read by
+// decompressing only the blocks it spans.
+long seal_bytes = 0;
+#define LZ_BLOCK_SIZE 65536
+#define LZ_MAGIC 0x315a4c53 /* "SLZ1" */
+#define LZ_STORED 0x80000000u /* block kept as is, it did not compress */
+
+struct lz_header {
+  uint32_t magic;
+  uint32_t block_size;
+  uint64_t block_count;
+  uint64_t raw_size;
+  uint64_t index_offset;
+};
+
+struct lz_block {
+  uint64_t offset; // in the compressed file
+  uint32_t size; // compressed size, or raw size | LZ_STORED
+  uint32_t raw_size;
+};
+
+struct seal_state {
+  long sealed[DB_COUNT]; // next segment number to seal into
+  long compressed[DB_COUNT]; // segments below this one are compressed
+};
+
+struct seal_state * seal = NULL; // in shared memory, set up by main when sealing
+
+// Tools: print a database (or a range of it) from all of its segments,
+// or measure the compressor on a file
+const char * cat_database = NULL;
+uint64_t read_offset = 0;
+uint64_t read_length = UINT64_MAX;
+const char * lz_bench_file = NULL;
+
+// Memory of a process, in kB, from /proc/<pid>/smaps_rollup. Private pages
+// are the ones only this process maps: for a forked worker that is mostly
+// the pages it wrote to since the fork, and which had to be copied.
+struct memory_usage {
+  long rss_kb;
+  long pss_kb;
+  long private_kb;
+  long shared_kb;
+};
+
+// The slot of one worker in shared memory. Only that worker writes it, and
+// every slot starts a cache line of its own, so the counting a worker does
+// never invalidates a line another worker is writing. Those that want
+// totals, the parent once the workers have finished and the watcher
+// (--watch-ms) while they run, add the slots up.
+enum { SLOT_STARTING, SLOT_RUNNING, SLOT_WAITING, SLOT_DONE };
+
+struct alignas(64) worker_slot {
+  pid_t pid;
+  int status;
+  int system; // of the current transaction
+  long txn; // transactions started so far, the current one included
+  uint64_t heartbeat_ns; // when it last started or finished a transaction
+  long transactions;
+  long pipelined; // transactions whose semaphores were acquired in advance
+  long appended; // single-record transactions, made without any lock
+  int source[PERF_COUNTERS]; // 0 = unavailable, 1 = event, 2 = fallback
+  uint64_t value[PERF_COUNTERS];
+  long waits; // acquisitions that found their semaphore, file lock or admission taken
+  uint64_t hold_ns; // with --parallelism, how long its transactions held their databases
+  struct memory_usage memory; // at the end of the worker's transaction loop
+};
+
+struct worker_slot * slots = NULL; // in shared memory, set up by main
+struct worker_slot * slot = NULL; // the one of this worker
+long watch_ms = 0; // 0 = no watcher
+
+// A system and the two databases (by semaphore index) it needs
+struct system_desc {
+  const char * name;
+  int db1;
+  int db2;
+};
+
+// The fixed topology of this deployment. Everything here is known at build
+// time, so the fixed kernels below have their resource order, semaphore
+// operations and record prefixes computed by the compiler.
+constexpr const char * db_filenames[DB_COUNT] = {
+  "faculty.txt", "students.txt", "statistics.txt", "staff.txt", "salary.txt"
+};
+constexpr system_desc topology[DB_COUNT] = {
+  { "Courses System", 0, 1 },
+  { "GPA Computation System", 1, 2 },
+  { "University Statistics System", 2, 3 },
+  { "Staff Management System", 3, 4 },
+  { "Faculty Payroll System", 4, 0 }
+};
+
+// A record prefix such as "Being used by Courses System (pid:"
+// that is assembled at compile time
+struct record_prefix {
+  char text[64];
+  int len;
+};
+
+constexpr record_prefix make_prefix(const char * head, const char * name, const char * tail) {
+  record_prefix prefix = {};
+  const char * parts[3] = { head, name, tail };
+  for(int part = 0; part < 3; part++) {
+    for(const char * c = parts[part]; *c != '\0'; c++) {
+      prefix.text[prefix.len++] = *c;
+    }
+  }
+  return prefix;
+}
+
+constexpr sembuf make_sem_op(int semid, int op, int flags = SEM_UNDO) {
+  sembuf sem = {};
+  sem.sem_num = semid;
+  sem.sem_op = op;
+  sem.sem_flg = flags;
+  return sem;
+}
+
+// Database transaction specialized for system I of the fixed topology.
+// Does the same work as open_and_write, but the admission semaphore and both
+// database semaphores are taken in a single semop (one system call, and
+// atomic so it cannot take part in a deadlock), and the records are written
+// straight from the compile-time prefixes with one write each. With admission
+// control the admission semaphore goes through admit first instead.
+template <int I>
+struct fixed_kernel {
+  static constexpr system_desc sys = topology[I];
+  static_assert(sys.db1 != sys.db2, "a system needs two distinct databases");
+  static constexpr record_prefix used = make_prefix("Being used by ", sys.name, " (pid:");
+  static constexpr record_prefix freed = make_prefix("Free from the ", sys.name, " (pid: ");
+
+  static int run(int semSet, int ** shm_ary) {
+    static sembuf acquire_ops[3] = {
+      make_sem_op(ADMISSION_SEM, -1), make_sem_op(sys.db1, -1), make_sem_op(sys.db2, -1)
+    };
+    static sembuf try_ops[3] = {
+      make_sem_op(ADMISSION_SEM, -1, SEM_UNDO | IPC_NOWAIT),
+      make_sem_op(sys.db1, -1, SEM_UNDO | IPC_NOWAIT), make_sem_op(sys.db2, -1, SEM_UNDO | IPC_NOWAIT)
+    };
+    static sembuf release_db1[1] = { make_sem_op(sys.db1, 1) };
+    static sembuf release_rest[2] = { make_sem_op(sys.db2, 1), make_sem_op(ADMISSION_SEM, 1) };
+    int pid = getpid();
+
+    // skip the admission semaphore in the operations when admit took it
+    int first = 0;
+    if(take_prefetched(I)) {
+      first = 3; // all acquired while the previous transaction was writing
+    }
+    else if(admission_bound > 0) {
+      if(!admit(semSet, I)) return -1;
+      first = 1;
+    }
+    if(first < 3 && logged_semop(semSet, try_ops + first, 3 - first) == -1) {
+      // blocked: split the wait between whoever holds the two databases now
+      int holders[2] = { *shm_ary[sys.db1] - 1, *shm_ary[sys.db2] - 1 };
+      double start = now_seconds();
+      slot_waiting();
+      logged_semop(semSet, acquire_ops + first, 3 - first);
+      slot_running();
+      double waited = now_seconds() - start;
+      int busy = (holders[0] >= 0) + (holders[1] >= 0);
+      if(busy == 0) record_blocked(I, UNKNOWN_HOLDER, ADMISSION_SEM, waited);
+      if(holders[0] >= 0) record_blocked(I, holders[0], sys.db1, waited / busy);
+      if(holders[1] >= 0) record_blocked(I, holders[1], sys.db2, waited / busy);
+    }
+    if(first < 3) {
+      claim_resource(shm_ary, sys.db1, I);
+      claim_resource(shm_ary, sys.db2, I);
+    }
+    if(parallel != NULL) enter_parallel();
+
+    int db1 = open(db_filenames[sys.db1], O_WRONLY | O_CREAT | O_APPEND, SHM_MODE);
+    int db2 = open(db_filenames[sys.db2], O_WRONLY | O_CREAT | O_APPEND, SHM_MODE);
+
+    if(!quiet) cout << sys.name << " (pid: " << pid << ") writing to " << db_filenames[sys.db1] << endl;
+    write_record(db1, sys.db1, used.text, used.len);
+    simulate_work();
+    try_prefetch(semSet, shm_ary);
+    if(!quiet) cout << sys.name << " (pid: " << pid << ") writing to " << db_filenames[sys.db2] << endl;
+    write_record(db2, sys.db2, used.text, used.len);
+    simulate_work();
+    try_prefetch(semSet, shm_ary);
+    write_record(db1, sys.db1, freed.text, freed.len);
+    write_record(db2, sys.db2, freed.text, freed.len);
+    if(store != NULL) publish_versions(sys.db1, sys.db2, sys.name);
+
+    if(parallel != NULL) leave_parallel(I);
+    close(db1);
+    if(seal_bytes > 0) maybe_seal(sys.db1);
+    *shm_ary[sys.db1] = 0;
+    logged_semop(semSet, release_db1, 1);
+    if(!quiet) cout << sys.name << " (pid: " << pid << ") freed up access to " << db_filenames[sys.db1] << endl;
+
+    close(db2);
+    if(seal_bytes > 0) maybe_seal(sys.db2);
+    *shm_ary[sys.db2] = 0;
+    logged_semop(semSet, release_rest, 2);
+    if(!quiet) cout << sys.name << " (pid: " << pid << ") freed up access to " << db_filenames[sys.db2] << endl;
+    return 0;
+  }
+};
+
+// One specialized kernel per system, indexed like topology
+typedef int (*kernel_fn)(int, int **);
+const kernel_fn fixed_kernels[DB_COUNT] = {
+  fixed_kernel<0>::run, fixed_kernel<1>::run, fixed_kernel<2>::run,
+  fixed_kernel<3>::run, fixed_kernel<4>::run
+};
+
+int main(int argc, char ** argv) {
+  int * shm_ary[5]; //array of pointers to shared mem sections
+  int pid;
+  uint64_t launched = now_ns();
+
+  parse_options(argc, argv);
+
+  // the tools work on the database files, and need no semaphores
+  if(cat_database != NULL) exit(cat_segments(cat_database, read_offset, read_length) ? 0 : -1);
+  if(lz_bench_file != NULL) exit(run_lz_bench(lz_bench_file) ? 0 : -1);
+  if(make_trace_file != NULL) exit(make_trace(make_trace_file) ? 0 : -1);
+  if(audit) exit(audit_databases() ? 0 : -1);
+  if(make_batch_file != NULL) exit(write_batch(make_batch_file, make_batch_count) ? 0 : -1);
+
+  if(ingest_file != NULL && !map_batch(ingest_file)) {
+    cout << "Can't map the batch " << ingest_file << endl;
+    exit(-1);
+  }
+
+  if(trace_file != NULL && !load_trace(trace_file)) {
+    cout << "Can't read the trace from " << trace_file << endl;
+    exit(-1);
+  }
+
+  if(replay_file != NULL && !load_grant_log(replay_file)) {
+    cout << "Can't read the schedule to replay from " << replay_file << endl;
+    exit(-1);
+  }
+
+  // a worker started with posix_spawn attaches to the state set up by its parent
+  if(spawned_worker >= 0) {
+    arena = (char *) get_pointer_to_mem(spawned_arena);
+    setup_shared_state(shm_ary, false);
+    run_worker(spawned_semset, shm_ary, spawned_worker);
+    exit(0);
+  }
+
+  if(debug) cout << "Parent process started" << endl;
+
+  // only the parent seeds the replicas: a spawned worker would copy over
+  // what the workers already started before it have replicated
+  if(replica_count > 0 && !seed_replicas()) {
+    cout << "Can't copy the databases to their replicas" << endl;
+    exit(-1);
+  }
+
+  //create 5 semaphores (1 per file)
+  //create a 6th semaphore to solve problem of deadlock if any would have occurred
+  int sem_count = split_hot > 0 ? SPLIT_SEM_COUNT : replica_count > 0 ? REPLICA_SEM_COUNT :
+                  partition_count > 0 ? PARTITION_SEM_COUNT : SEM_COUNT;
+  int semSet = create_semaphore_set(sem_count);
+  if(debug) cout << "Created semaphore set: " << semSet << endl;
+
+  // initialize the first 5 semaphores to 1, and the 6th semaphore to a value
+  // of 4 so that only 4 processes have access to the 5 files at once. This will
+  // eliminate any deadlock that could occur if all 5 processes had hold of one
+  // file and was waiting for their other file to become free
+  // (with --split-hot, a database semaphore holds one token per stripe and
+  // each stripe has a semaphore of its own, see split_state, and with
+  // --replicas or --partitions so does each replica or partition)
+  int db_tokens = split_hot > 0 ? DB_STRIPES : 1;
+  if(fast_start) {
+    static_assert(REPLICA_SEM_COUNT <= SPLIT_SEM_COUNT && PARTITION_SEM_COUNT <= SPLIT_SEM_COUNT, "values too short");
+    unsigned short values[SPLIT_SEM_COUNT] = { 1, 1, 1, 1, 1, 4, 1 };
+    for(int sem = 0; sem < DB_COUNT; sem++) values[sem] = db_tokens;
+    for(int sem = SEM_COUNT; sem < sem_count; sem++) values[sem] = 1;
+    init_all_sems(semSet, values);
+  }
+  else {
+    for(int sem = 0; sem < 5; sem++) init_sem(semSet, sem, db_tokens);
+    init_sem(semSet, 5, 4);
+    init_sem(semSet, QUEUE_SEM, 1);
+    for(int sem = SEM_COUNT; sem < sem_count; sem++) init_sem(semSet, sem, 1);
+  }
+
+  // With --fast-start all the shared state lives in a single segment: a first
+  // pass of setup_shared_state only adds up its size
+  int arenaId = -1;
+  if(fast_start) {
+    measuring = true;
+    setup_shared_state(shm_ary, false);
+    measuring = false;
+    if((arenaId = create_shared_mem_id(arena_used)) == -1) {
+      cout << "Failed getting shared memory" << endl;
+      exit(-1);
+    }
+    segment_ids.push_back(arenaId);
+    arena = (char *) get_pointer_to_mem(arenaId);
+    arena_used = 0;
+  }
+  setup_shared_state(shm_ary, true);
+  startup->launched_ns = launched;
+
+  // the snapshot readers
+  pid_t reader_pids[MAX_READERS];
+  for(int r = 0; r < reader_count; r++) {
+    if((reader_pids[r] = fork()) == 0) {
+      run_reader(r);
+      exit(0);
+    }
+  }
+
+  // the compressor of the sealed segments
+  pid_t compressor_pid = -1;
+  if(seal_bytes > 0 && (compressor_pid = fork()) == 0) {
+    run_compressor();
+    exit(0);
+  }
+
+  // the eventfds of the workers
+  for(int w = 0; event_grants && w < worker_count; w++) {
+    if((event_fds[w] = eventfd(0, EFD_NONBLOCK)) == -1) {
+      perror("eventfd error");
+      exit(-1);
+    }
+  }
+
+  // the ticker of the timer wheel
+  pid_t ticker_pid = -1;
+  if(wheel != NULL && (ticker_pid = fork()) == 0) {
+    run_ticker();
+    exit(0);
+  }
+
+  // the watcher of the worker slots
+  pid_t watcher_pid = -1;
+  if(watch_ms > 0 && (watcher_pid = fork()) == 0) {
+    run_watcher();
+    exit(0);
+  }
+
+  // anything still buffered would be copied into, and flushed by, every worker
+  if(lean_fork) {
+    cout.flush();
+    fflush(NULL);
+  }
+
+  if(partitions != NULL) measure_partitions(partition_bytes);
+  double start = now_seconds();
+  for(int i=0; i < worker_count; i++) {
+    if(spawn_workers) {
+      pid = spawn_worker(argc, argv, semSet, arenaId, i);
+    }
+    else {
+      pid = fork();
+    }
+    if(pid < 0) {
+      fprintf(stderr, "Fork Failed");
+      exit(-1);
+    }
+    if (pid == 0) { /* child process */
+      if(debug) cout << "Running child process " << getpid() << endl;
+      run_worker(semSet, shm_ary, i);
+      exit(0);
+    }
+    else { /* parent process */
+      continue;
+    }
+  }
+  if(debug) cout << "Parent waiting for children to all finish" << endl;
+  int j; // will hold the value of the pid of the finished child process
+  int workers_left = worker_count;
+  while((j = wait(NULL)) != -1) {
+    if(debug) cout << "Child " << j << " finished" << endl;
+    bool helper = j == compressor_pid || j == ticker_pid || j == watcher_pid;
+    for(int r = 0; r < reader_count; r++) helper = helper || reader_pids[r] == j;
+    // the readers, the compressor, the ticker and the watcher keep going for as long as there are workers
+    if(!helper && --workers_left == 0) {
+      __atomic_store_n(&startup->workers_done, true, __ATOMIC_RELEASE);
+    }
+  }
+  if(bench) print_bench_report(slots, now_seconds() - start);
+  if(print_blocking) print_blocked_by();
+  if(metrics_file != NULL) write_metrics(metrics_file);
+  if(rate_bytes > 0 || rate_ops > 0) print_throttling();
+  if(queue != NULL) print_schedule_report();
+  if(admission_bound > 0) print_admission_report();
+  if(budget != NULL) print_pool_report();
+  if(parallel != NULL) print_parallelism_report(now_seconds() - start);
+  if(wheel != NULL) print_wheel_report();
+  if(reads != NULL) print_replica_report();
+  if(partitions != NULL) print_partition_report(now_seconds() - start);
+  if(events != NULL) print_event_report();
+  if(store != NULL) print_reader_report();
+  if(record_file != NULL) write_grant_log(record_file);
+  if(replay_file != NULL) print_replay_report();
+  if(split != NULL) print_split_report();
+  if(ingest != NULL) print_ingest_report(now_seconds() - start);
+
+  // Cleanup (destroy) all the shared memory segments
+  for(size_t i = 0; i < segment_ids.size(); i++) {
+    if(destroy_mem_segment(segment_ids[i]) != -1) {
+      if(debug) cout << "Deleted memory segment with ID " << segment_ids[i] << endl;
+    }
+    else {
+      cout << "Error occurred destroying memory segment" << endl;
+    }
+  }
+
+  // Remove all semaphores in the set of semaphores
+  // (start at index 0 and remove all from then on)
+  int semId;
+  if(semId = (semctl(semSet, 0, IPC_RMID, 0)) == -1){
+    perror("Semaphore was not removed.\n");
+  }
+  else{
+    if(debug) cout << "Semaphores were removed succesfully" << endl;
+  }
+
+  // Done!
+  if(debug) cout << "Parent process finished" << endl;
+  exit(0);
+}
+
+// Sets up the pointers to everything the processes share in shared memory
+// (in the same order every time, see shared_alloc), and when init is set
+// also gives it its initial values
+void setup_shared_state(int ** shm_ary, bool init) {
+  for(int sem = 0; sem < 5; sem++) {
+    shm_ary[sem] = (int *) shared_alloc(sizeof(int));
+    if(init) {
+      *shm_ary[sem] = 0; //store 0 as the initial value
+      if(debug) cout << "Added shared mem " << shm_ary[sem] << " to shm_ary[" << sem << "]" << endl;
+    }
+  }
+
+  startup = (struct startup_times *) shared_alloc(sizeof(struct startup_times));
+  // the admission control state is shared by all the workers
+  admission = (struct admission_state *) shared_alloc(sizeof(struct admission_state));
+  // one slot per worker
+  slots = (struct worker_slot *) shared_alloc(sizeof(struct worker_slot) * worker_count);
+  // the blocked-by matrices are shared by all the workers
+  blocking = (struct blocking_stats *) shared_alloc(sizeof(struct blocking_stats));
+  // and so are the token buckets of the database files
+  buckets = (struct file_buckets *) shared_alloc(sizeof(struct file_buckets) * DB_COUNT);
+  if(init) {
+    memset(startup, 0, sizeof(struct startup_times));
+    memset(admission, 0, sizeof(struct admission_state));
+    memset(slots, 0, sizeof(struct worker_slot) * worker_count);
+    memset(blocking, 0, sizeof(struct blocking_stats));
+    memset(buckets, 0, sizeof(struct file_buckets) * DB_COUNT);
+  }
+
+  // in pool mode, the transactions of all workers are queued up front
+  if(schedule != POLICY_NONE) {
+    long total = queued_count();
+    queue = (struct txn_queue *) shared_alloc(sizeof(struct txn_queue));
+    queued_txns = (struct txn *) shared_alloc(sizeof(struct txn) * total);
+    if(init) fill_queue();
+  }
+
+  // the cursor of the batch being ingested
+  if(ingest_file != NULL) {
+    ingest = (struct ingest_state *) shared_alloc(sizeof(struct ingest_state));
+    if(init) memset(ingest, 0, sizeof(struct ingest_state));
+  }
+
+  // how many transactions hold their databases, and for how long
+  if(parallelism) {
+    parallel = (struct parallelism_state *) shared_alloc(sizeof(struct parallelism_state));
+    if(init) memset(parallel, 0, sizeof(struct parallelism_state));
+  }
+
+  // who waits for which database grant
+  if(event_grants) {
+    events = (struct grant_events *) shared_alloc(sizeof(struct grant_events));
+    if(init) memset(events, 0, sizeof(struct grant_events));
+  }
+
+  // the owners of the partitions
+  if(partition_count > 0) {
+    partitions = (struct partition_state *) shared_alloc(sizeof(struct partition_state));
+    if(init) memset(partitions, 0, sizeof(struct partition_state));
+  }
+
+  // the load of the replicas
+  if(read_pct > 0 || replica_count > 0) {
+    reads = (struct replica_state *) shared_alloc(sizeof(struct replica_state));
+    if(init) memset(reads, 0, sizeof(struct replica_state));
+  }
+
+  // the timer wheel, with no timer armed
+  if(acquire_timeout_usec > 0) {
+    wheel = (struct timer_wheel *) shared_alloc(sizeof(struct timer_wheel));
+    if(init) {
+      memset(wheel, 0, sizeof(struct timer_wheel));
+      wheel->start_ns = now_ns();
+      for(int list = 0; list <= EXPIRED_LIST; list++) wheel->heads[list] = -1;
+      for(int w = 0; w < MAX_WORKERS; w++) wheel->timers[w].list = -1;
+    }
+  }
+
+  // the admission pools, with all the tokens in the global budget at first
+  if(admission_pools > 0) {
+    budget = (struct admission_budget *) shared_alloc(sizeof(struct admission_budget));
+    if(init) {
+      memset(budget, 0, sizeof(struct admission_budget));
+      budget->tokens = ADMISSION_TOKENS;
+    }
+  }
+
+  // the tails of the database files, for staged writes
+  if(staged_writes) {
+    tails = (struct file_tail *) shared_alloc(sizeof(struct file_tail) * DB_COUNT);
+    if(init) {
+      memset(tails, 0, sizeof(struct file_tail) * DB_COUNT);
+      for(int db = 0; db < DB_COUNT; db++) {
+        struct stat st;
+        if(stat(db_filenames[db], &st) == 0) tails[db].reserved = tails[db].high_water = st.st_size;
+      }
+    }
+  }
+
+  // the modes of the databases and their contention
+  if(split_hot > 0) {
+    split = (struct split_state *) shared_alloc(sizeof(struct split_state));
+    if(init) {
+      memset(split, 0, sizeof(struct split_state));
+      for(int db = 0; db < DB_COUNT; db++) split->window_start_ns[db] = now_ns();
+    }
+  }
+
+  // the grant log, or whose turn it is in the replay
+  if(record_file != NULL || replay_file != NULL) {
+    uint64_t capacity = record_file != NULL ? (uint64_t) worker_count * txn_count * GRANT_LOG_PER_TXN : 0;
+    grants = (struct grant_log *) shared_alloc(sizeof(struct grant_log));
+    if(capacity > 0) logged_grants = (struct grant_event *) shared_alloc(sizeof(struct grant_event) * capacity);
+    if(init) {
+      memset(grants, 0, sizeof(struct grant_log));
+      grants->capacity = capacity;
+    }
+  }
+
+  // the segment numbers of the databases
+  if(seal_bytes > 0) {
+    seal = (struct seal_state *) shared_alloc(sizeof(struct seal_state));
+    if(init) {
+      memset(seal, 0, sizeof(struct seal_state));
+      for(int db = 0; db < DB_COUNT; db++) {
+        seal->sealed[db] = seal->compressed[db] = first_free_segment(db_filenames[db]);
+      }
+    }
+  }
+
+  // the versions read by the snapshot readers
+  if(reader_count > 0) {
+    store = (struct mvcc_store *) shared_alloc(sizeof(struct mvcc_store));
+    if(init) init_versions();
+  }
+}
+
+// Returns shared memory of the given size for setup_shared_state: a segment
+// of its own, or the next piece of the single segment with --fast-start
+// (which, while measuring, only counts the size)
+void * shared_alloc(size_t size) {
+  if(measuring || arena != NULL) {
+    void * piece = measuring ? NULL : arena + arena_used;
+    arena_used += (size + 63) & ~(size_t) 63; // every piece starts a cache line
+    return piece;
+  }
+  int id;
+  if((id = create_shared_mem_id(size)) == -1) {
+    cout << "Failed getting shared memory" << endl;
+    exit(-1);
+  }
+  segment_ids.push_back(id);
+  return get_pointer_to_mem(id);
+}
+
+// Starts worker i as a new process running this program with posix_spawn,
+// which does not copy the parent like fork does. The worker is told where
+// to find the semaphore set and the shared state, and gets all the other
+// options from the command line of the parent.
+pid_t spawn_worker(int argc, char ** argv, int semSet, int arenaId, int i) {
+  char semText[16], arenaText[16], workerText[16];
+  snprintf(semText, sizeof(semText), "%d", semSet);
+  snprintf(arenaText, sizeof(arenaText), "%d", arenaId);
+  snprintf(workerText, sizeof(workerText), "%d", i);
+  char * args[argc + 5];
+  for(int arg = 0; arg < argc; arg++) args[arg] = argv[arg];
+  args[argc] = (char *) "--worker-of";
+  args[argc + 1] = semText;
+  args[argc + 2] = arenaText;
+  args[argc + 3] = workerText;
+  args[argc + 4] = NULL;
+  pid_t pid;
+  int error = posix_spawn(&pid, "/proc/self/exe", NULL, NULL, args, environ);
+  if(error != 0) {
+    errno = error;
+    perror("posix_spawn error");
+    return -1;
+  }
+  return pid;
+}
+
+// Reads the command line options into the global flags
+void parse_options(int argc, char ** argv) {
+  for(int arg = 1; arg < argc; arg++) {
+    if(strcmp(argv[arg], "--debug") == 0) {
+      debug = true;
+    }
+    else if(strcmp(argv[arg], "--fixed") == 0) {
+      fixed_topology = true;
+    }
+    else if(strcmp(argv[arg], "--workers") == 0 && arg + 1 < argc) {
+      worker_count = atoi(argv[++arg]);
+      if(worker_count < 1 || worker_count > MAX_WORKERS) {
+        cout << "--workers must be between 1 and " << MAX_WORKERS << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--transactions") == 0 && arg + 1 < argc) {
+      txn_count = atoi(argv[++arg]);
+      if(txn_count < 1 || txn_count > MAX_TRANSACTIONS) {
+        cout << "--transactions must be between 1 and " << MAX_TRANSACTIONS << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--work-usec") == 0 && arg + 1 < argc) {
+      work_usec = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--bench") == 0) {
+      bench = true;
+      quiet = true;
+    }
+    else if(strcmp(argv[arg], "--blocked-by") == 0) {
+      print_blocking = true;
+    }
+    else if(strcmp(argv[arg], "--metrics") == 0 && arg + 1 < argc) {
+      metrics_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--rate-bytes") == 0 && arg + 1 < argc) {
+      rate_bytes = atof(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--rate-ops") == 0 && arg + 1 < argc) {
+      rate_ops = atof(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--schedule") == 0 && arg + 1 < argc) {
+      arg++;
+      if(strcmp(argv[arg], "fifo") == 0) schedule = POLICY_FIFO;
+      else if(strcmp(argv[arg], "edf") == 0) schedule = POLICY_EDF;
+      else {
+        cout << "Unknown schedule " << argv[arg] << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--arrival-usec") == 0 && arg + 1 < argc) {
+      arrival_usec = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--deadline") == 0 && arg + 1 < argc) {
+      int system;
+      long ms;
+      if(sscanf(argv[++arg], "%d=%ld", &system, &ms) != 2 || system < 0 || system >= DB_COUNT) {
+        cout << "--deadline takes SYSTEM=MS, with SYSTEM from 0 to " << DB_COUNT - 1 << endl;
+        exit(-1);
+      }
+      deadline_ms[system] = ms;
+    }
+    else if(strcmp(argv[arg], "--reject-late") == 0) {
+      reject_late = true;
+    }
+    else if(strcmp(argv[arg], "--admission-queue") == 0 && arg + 1 < argc) {
+      admission_bound = atoi(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--overflow") == 0 && arg + 1 < argc) {
+      arg++;
+      if(strcmp(argv[arg], "reject") == 0) overflow_policy = OVERFLOW_REJECT;
+      else if(strcmp(argv[arg], "drop-oldest") == 0) overflow_policy = OVERFLOW_DROP_OLDEST;
+      else if(strcmp(argv[arg], "codel") == 0) overflow_policy = OVERFLOW_CODEL;
+      else {
+        cout << "Unknown overflow policy " << argv[arg] << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--codel-target-usec") == 0 && arg + 1 < argc) {
+      codel_target_usec = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--codel-interval-usec") == 0 && arg + 1 < argc) {
+      codel_interval_usec = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--readers") == 0 && arg + 1 < argc) {
+      reader_count = atoi(argv[++arg]);
+      if(reader_count < 0 || reader_count > MAX_READERS) {
+        cout << "--readers must be between 0 and " << MAX_READERS << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--pipeline") == 0) {
+      pipeline = true;
+    }
+    else if(strcmp(argv[arg], "--fast-start") == 0) {
+      fast_start = true;
+    }
+    else if(strcmp(argv[arg], "--spawn") == 0) {
+      fast_start = true; // a spawned worker finds all the state from one segment id
+      spawn_workers = true;
+    }
+    else if(strcmp(argv[arg], "--worker-of") == 0 && arg + 3 < argc) {
+      spawned_semset = atoi(argv[++arg]);
+      spawned_arena = atoi(argv[++arg]);
+      spawned_worker = atoi(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--seal-bytes") == 0 && arg + 1 < argc) {
+      seal_bytes = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--cat") == 0 && arg + 1 < argc) {
+      cat_database = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--range") == 0 && arg + 2 < argc) {
+      read_offset = strtoull(argv[++arg], NULL, 10);
+      read_length = strtoull(argv[++arg], NULL, 10);
+    }
+    else if(strcmp(argv[arg], "--lz-bench") == 0 && arg + 1 < argc) {
+      lz_bench_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--lean-fork") == 0) {
+      lean_fork = true;
+    }
+    else if(strcmp(argv[arg], "--record") == 0 && arg + 1 < argc) {
+      record_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--replay") == 0 && arg + 1 < argc) {
+      replay_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--make-trace") == 0 && arg + 1 < argc) {
+      make_trace_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+      trace_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--trace-speed") == 0 && arg + 1 < argc) {
+      trace_speed = atof(argv[++arg]);
+      if(trace_speed <= 0) {
+        cout << "--trace-speed must be positive" << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--split-hot") == 0 && arg + 1 < argc) {
+      split_hot = atoi(argv[++arg]);
+      if(split_hot < 1 || split_hot > 100) {
+        cout << "--split-hot must be a percentage between 1 and 100" << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--locks") == 0 && arg + 1 < argc) {
+      arg++;
+      if(strcmp(argv[arg], "sysv") == 0) lock_backend = LOCKS_SYSV;
+      else if(strcmp(argv[arg], "ofd") == 0) lock_backend = LOCKS_OFD;
+      else if(strcmp(argv[arg], "ofd-record") == 0) lock_backend = LOCKS_OFD_RECORD;
+      else {
+        cout << "--locks must be sysv, ofd or ofd-record" << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--staged-writes") == 0) {
+      staged_writes = true;
+    }
+    else if(strcmp(argv[arg], "--ingest") == 0 && arg + 1 < argc) {
+      ingest_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--make-batch") == 0 && arg + 2 < argc) {
+      make_batch_count = atol(argv[++arg]);
+      make_batch_file = argv[++arg];
+    }
+    else if(strcmp(argv[arg], "--admission-pools") == 0 && arg + 1 < argc) {
+      admission_pools = atoi(argv[++arg]);
+      if(admission_pools < 1 || admission_pools > MAX_ADMISSION_POOLS) {
+        cout << "--admission-pools must be between 1 and " << MAX_ADMISSION_POOLS << endl;
+        exit(-1);
+      }
+      pool_batch = ADMISSION_TOKENS / admission_pools > 1 ? ADMISSION_TOKENS / admission_pools : 1;
+    }
+    else if(strcmp(argv[arg], "--single-pct") == 0 && arg + 1 < argc) {
+      single_pct = atoi(argv[++arg]);
+      if(single_pct < 0 || single_pct > 100) {
+        cout << "--single-pct must be between 0 and 100" << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--parallelism") == 0) {
+      parallelism = true;
+    }
+    else if(strcmp(argv[arg], "--acquire-timeout-usec") == 0 && arg + 1 < argc) {
+      acquire_timeout_usec = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--backoff-usec") == 0 && arg + 1 < argc) {
+      backoff_usec = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--read-pct") == 0 && arg + 1 < argc) {
+      read_pct = atoi(argv[++arg]);
+      if(read_pct < 0 || read_pct > 100) {
+        cout << "--read-pct must be between 0 and 100" << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--replicas") == 0 && arg + 1 < argc) {
+      replica_count = atoi(argv[++arg]);
+      if(replica_count < 0 || replica_count > MAX_REPLICAS) {
+        cout << "--replicas must be between 0 and " << MAX_REPLICAS << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--partitions") == 0 && arg + 1 < argc) {
+      partition_count = atoi(argv[++arg]);
+      if(partition_count < 0 || partition_count > MAX_PARTITIONS) {
+        cout << "--partitions must be between 0 and " << MAX_PARTITIONS << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--partition-dirs") == 0 && arg + 1 < argc) {
+      if(!parse_partition_dirs(argv[++arg])) {
+        cout << "--partition-dirs takes at most " << MAX_PARTITION_DIRS << " directories" << endl;
+        exit(-1);
+      }
+    }
+    else if(strcmp(argv[arg], "--watch-ms") == 0 && arg + 1 < argc) {
+      watch_ms = atol(argv[++arg]);
+    }
+    else if(strcmp(argv[arg], "--event-grants") == 0) {
+      event_grants = true;
+    }
+    else if(strcmp(argv[arg], "--audit") == 0) {
+      audit = true;
+    }
+    else if(strcmp(argv[arg], "--allow-overlap") == 0) {
+      allow_overlap = true;
+    }
+    else if(strcmp(argv[arg], "--help") == 0) {
+      print_usage(argv[0]);
+      exit(0);
+    }
+    else {
+      cout << "Unknown option " << argv[arg] << endl;
+      print_usage(argv[0]);
+      exit(-1);
+    }
+  }
+  if(pipeline && schedule == POLICY_NONE) {
+    cout << "--pipeline needs a pool of transactions, see --schedule" << endl;
+    exit(-1);
+  }
+  if(trace_file != NULL && schedule == POLICY_NONE) {
+    cout << "--trace feeds the pool of transactions, see --schedule" << endl;
+    exit(-1);
+  }
+  // the fixed kernels and pipelining take whole-file locks by construction,
+  // and snapshot versions are made one database holder at a time
+  if(split_hot > 0 && (fixed_topology || pipeline || reader_count > 0)) {
+    cout << "--split-hot can't be used with --fixed, --pipeline or --readers" << endl;
+    exit(-1);
+  }
+  // the file locks are taken by the runtime path, on files that stay put
+  if(lock_backend != LOCKS_SYSV && (fixed_topology || pipeline || split_hot > 0 || seal_bytes > 0)) {
+    cout << "--locks ofd can't be used with --fixed, --pipeline, --split-hot or --seal-bytes" << endl;
+    exit(-1);
+  }
+  // staged writes are made by the runtime path, into files that stay put
+  if(staged_writes && (fixed_topology || pipeline || seal_bytes > 0)) {
+    cout << "--staged-writes can't be used with --fixed, --pipeline or --seal-bytes" << endl;
+    exit(-1);
+  }
+  // a lockless append would land in the middle of a reservation, in a sealed
+  // segment, or behind the back of the snapshot versions, and it can't use
+  // resources acquired in advance
+  if(single_pct > 0 && (staged_writes || seal_bytes > 0 || reader_count > 0 || pipeline)) {
+    cout << "--single-pct can't be used with --staged-writes, --seal-bytes, --readers or --pipeline" << endl;
+    exit(-1);
+  }
+  // striped and record locks let transactions of conflicting systems hold
+  // the same database, which the conflict graph does not allow for
+  if(parallelism && (split_hot > 0 || lock_backend == LOCKS_OFD_RECORD)) {
+    cout << "--parallelism can't be used with --split-hot or --locks ofd-record" << endl;
+    exit(-1);
+  }
+  // timed acquisitions are made by the runtime path, of whole databases, and
+  // retries change the order in which semaphores are granted
+  if(acquire_timeout_usec > 0 && (fixed_topology || pipeline || split_hot > 0 || lock_backend != LOCKS_SYSV ||
+                                  record_file != NULL || replay_file != NULL)) {
+    cout << "--acquire-timeout-usec can't be used with --fixed, --pipeline, --split-hot, --locks ofd, --record or --replay" << endl;
+    exit(-1);
+  }
+  // the replicas take the records of the runtime path as it commits, into
+  // files that stay put, and have the semaphores the stripes would use
+  if(replica_count > 0 && (fixed_topology || staged_writes || seal_bytes > 0 || split_hot > 0 ||
+                           lock_backend != LOCKS_SYSV || single_pct > 0)) {
+    cout << "--replicas can't be used with --fixed, --staged-writes, --seal-bytes, --split-hot, --locks ofd or --single-pct" << endl;
+    exit(-1);
+  }
+  // the partitions take the place of the database semaphores, which all the
+  // other ways of locking, reading or writing a database go through
+  if(partition_count > 0 && (fixed_topology || pipeline || split_hot > 0 || lock_backend != LOCKS_SYSV ||
+                             staged_writes || seal_bytes > 0 || reader_count > 0 || single_pct > 0 ||
+                             read_pct > 0 || replica_count > 0 || acquire_timeout_usec > 0 || parallelism)) {
+    cout << "--partitions can't be used with --fixed, --pipeline, --split-hot, --locks ofd, --staged-writes, --seal-bytes, "
+         << "--readers, --single-pct, --read-pct, --replicas, --acquire-timeout-usec or --parallelism" << endl;
+    exit(-1);
+  }
+  // the grants are of whole semaphores, and spawned workers don't know the
+  // eventfds of the others
+  if(event_grants && (fixed_topology || pipeline || split_hot > 0 || lock_backend != LOCKS_SYSV || partition_count > 0 ||
+                      spawn_workers || record_file != NULL || replay_file != NULL || admission_bound > 0 ||
+                      admission_pools > 0 || replica_count > 0)) {
+    cout << "--event-grants can't be used with --fixed, --pipeline, --split-hot, --locks ofd, --partitions, --spawn, --record, --replay, "
+         << "--admission-queue, --admission-pools or --replicas" << endl;
+    exit(-1);
+  }
+  for(int dir = 0; partition_count > 0 && dir < partition_dir_count; dir++) {
+    struct stat st;
+    if(stat(partition_dirs[dir], &st) != 0 || !S_ISDIR(st.st_mode)) {
+      cout << "No directory " << partition_dirs[dir] << " for the partitions" << endl;
+      exit(-1);
+    }
+  }
+  if(ingest_file != NULL && schedule != POLICY_NONE) {
+    cout << "--ingest runs the batch as it comes, it can't be used with --schedule" << endl;
+    exit(-1);
+  }
+  // the fixed kernels and pipelining take the admission semaphore in the same
+  // semop as the databases, and admission control queues on it
+  if(admission_pools > 0 && (fixed_topology || pipeline || admission_bound > 0)) {
+    cout << "--admission-pools can't be used with --fixed, --pipeline or --admission-queue" << endl;
+    exit(-1);
+  }
+  if(record_file != NULL && replay_file != NULL) {
+    cout << "--record and --replay can't be used together" << endl;
+    exit(-1);
+  }
+  // shedding depends on timing, which a replay does not reproduce, and pooled
+  // admission takes no semaphore for the log to put in order
+  if((record_file != NULL || replay_file != NULL) && (admission_bound > 0 || admission_pools > 0)) {
+    cout << "--record and --replay can't be used with --admission-queue or --admission-pools" << endl;
+    exit(-1);
+  }
+  // a benchmark measures the locking, not the simulated database action
+  if(work_usec < 0) work_usec = bench ? 0 : 1000000;
+}
+
+// Prints out the supported command line options
+void print_usage(const char * program) {
+  cout << "Usage: " << program << " [options]" << endl;
+  cout << "  --debug    print the low level semaphore and shared memory actions" << endl;
+  cout << "  --fixed    run the compile-time specialized kernel for each system" << endl;
+  cout << "  --workers N        number of worker processes (default 5)" << endl;
+  cout << "  --transactions N   transactions run by each worker (default 1)" << endl;
+  cout << "  --work-usec N      simulated database action per write (default 1s, 0 in --bench)" << endl;
+  cout << "  --bench            report throughput and performance counters per configuration" << endl;
+  cout << "  --blocked-by       print which systems stalled which (and on what) at shutdown" << endl;
+  cout << "  --metrics FILE     export the blocked-by matrices as a metrics textfile" << endl;
+  cout << "  --rate-bytes N     limit writes to each database file to N bytes per second" << endl;
+  cout << "  --rate-ops N       limit writes to each database file to N writes per second" << endl;
+  cout << "  --schedule POLICY  pool mode: workers take queued transactions by fifo or edf" << endl;
+  cout << "  --arrival-usec N   pool mode: time between the arrivals of two transactions" << endl;
+  cout << "  --deadline SYS=MS  transactions of system SYS must finish MS after arriving" << endl;
+  cout << "  --reject-late      edf: reject rather than defer what cannot make its deadline" << endl;
+  cout << "  --admission-queue N  at most N processes queue for admission, the others fail fast" << endl;
+  cout << "  --overflow POLICY  who is shed from a full admission queue: reject, drop-oldest or codel" << endl;
+  cout << "  --codel-target-usec N, --codel-interval-usec N  codel queueing delay target and interval" << endl;
+  cout << "  --admission-pools N  admit through N per-CPU token pools instead of the admission semaphore" << endl;
+  cout << "  --pipeline         pool mode: acquire the next transaction's resources during this one's writes" << endl;
+  cout << "  --fast-start       initialize the semaphores with SETALL and share one memory segment" << endl;
+  cout << "  --spawn            start the workers with posix_spawn instead of fork (implies --fast-start)" << endl;
+  cout << "  --lean-fork        keep the pages forked workers copy from the parent to a minimum" << endl;
+  cout << "  --seal-bytes N     seal a database file past N bytes, and compress it in the background" << endl;
+  cout << "  --cat FILE         print a database from all its segments, decompressing them" << endl;
+  cout << "  --range OFF LEN    with --cat, print only LEN bytes from offset OFF" << endl;
+  cout << "  --lz-bench FILE    measure the block compressor on a file" << endl;
+  cout << "  --make-trace FILE  reconstruct the transactions of the database files into a trace" << endl;
+  cout << "  --trace FILE       pool mode: queue the transactions of a trace" << endl;
+  cout << "  --trace-speed X    with --trace, run the trace X times faster" << endl;
+  cout << "  --record FILE      log the order in which the workers get and release semaphores" << endl;
+  cout << "  --replay FILE      force the order of a log made with --record" << endl;
+  cout << "  --split-hot PCT    split the lock of a database into stripes while PCT% of its acquisitions wait" << endl;
+  cout << "  --locks KIND       lock the databases with sysv semaphores, or ofd / ofd-record file locks" << endl;
+  cout << "  --staged-writes    reserve room for the records under the locks, and write them after release" << endl;
+  cout << "  --ingest FILE      run the transactions of a text or binary batch file, streamed" << endl;
+  cout << "  --make-batch N FILE  write a batch of N transactions (binary if FILE ends in .bin)" << endl;
+  cout << "  --single-pct PCT   PCT% of the transactions append one record to one database, without locks" << endl;
+  cout << "  --parallelism      compare the concurrency achieved with what the conflicts between systems allow" << endl;
+  cout << "  --acquire-timeout-usec N  give up on databases not acquired within N us, back off and retry" << endl;
+  cout << "  --backoff-usec N   first back-off after a timed out acquisition (default 1000), doubling" << endl;
+  cout << "  --read-pct PCT     PCT% of the transactions read the last record of one database" << endl;
+  cout << "  --replicas N       keep N replicas of every database, and read from the least loaded one" << endl;
+  cout << "  --partitions N     split every database by key into N files, each with a lock of its own" << endl;
+  cout << "  --partition-dirs DIR,...  directories the partitions are spread over (default .)" << endl;
+  cout << "  --watch-ms N       every N ms, print what the workers are doing, from their slots" << endl;
+  cout << "  --event-grants     wait for semaphore grants, and timers, on an eventfd in an epoll loop" << endl;
+  cout << "  --audit            check that the records of the database files are whole and properly paired" << endl;
+  cout << "  --allow-overlap    with --audit, don't fail on locked transactions that overlap (striped or record locks)" << endl;
+  cout << "  --readers N        N processes read snapshots of the databases while the workers run" << endl;
+}
+
+// Handler of the wakeups of the timer wheel, which only need to interrupt
+// the system call they arrive in
+void wake_waiter(int) {
+}
+
+// Body of a worker process: runs its transactions, measuring them
+// with the performance counters when in benchmark mode
+void run_worker(int semSet, int ** shm_ary, int i) {
+  int fds[PERF_COUNTERS];
+  int sources[PERF_COUNTERS];
+  if(bench) open_perf_counters(fds, sources);
+
+  worker_id = i;
+  for(int db = 0; db < DB_COUNT; db++) {
+    for(int k = 0; k < MAX_REPLICAS; k++) replica_fds[db][k] = -1;
+  }
+  slot = &slots[i];
+  slot->pid = getpid();
+  if(events != NULL) open_event_loop();
+  // the ticker of the timer wheel interrupts a wait with a signal that does nothing
+  if(wheel != NULL && events == NULL) {
+    struct sigaction wakeup = {};
+    wakeup.sa_handler = wake_waiter;
+    sigaction(SIGUSR1, &wakeup, NULL);
+  }
+  if(__atomic_add_fetch(&startup->ready, 1, __ATOMIC_ACQ_REL) == worker_count) {
+    __atomic_store_n(&startup->all_ready_ns, now_ns(), __ATOMIC_RELEASE);
+  }
+  if(queue != NULL) {
+    long k = take_transaction(semSet, shm_ary, true, -1);
+    while(k != -1) {
+      // with pipelining, the next transaction is known while this one runs,
+      // and it is one that does not need this one's databases
+      long next = pipeline ? take_transaction(semSet, shm_ary, false, queued_txns[k].system) : -2;
+      prefetch.next = next >= 0 ? queued_txns[next].system : -1;
+      uint64_t started = now_ns();
+      txn_hold_usec = queued_txns[k].hold_usec;
+      if(run_transaction(semSet, shm_ary, queued_txns[k].system) == 0) {
+        finish_transaction(k, started);
+        __atomic_store_n(&slot->transactions, slot->transactions + 1, __ATOMIC_RELAXED);
+      }
+      else if(queued_txns[k].deadline_ns != 0) {
+        __atomic_fetch_add(&queue->missed, 1, __ATOMIC_RELAXED);
+      }
+      k = next != -2 ? next : take_transaction(semSet, shm_ary, true, -1);
+    }
+    slot->pipelined = prefetch.hits;
+  }
+  else if(ingest != NULL) {
+    ingest_batch(semSet, shm_ary, slot);
+  }
+  else {
+    int system = i % DB_COUNT;
+    for(int txn = 0; txn < txn_count; txn++) {
+      if(run_transaction(semSet, shm_ary, system) == 0) {
+        __atomic_store_n(&slot->transactions, slot->transactions + 1, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  // a worker that is done before its last recorded grant has diverged
+  if(replay_events != NULL && next_replay_event() != -1) abandon_replay(grants->next_seq);
+  slot->appended = appended_txns;
+  if(bench) read_perf_counters(fds, sources, slot);
+  if(bench) read_memory_usage("/proc/self/smaps_rollup", &slot->memory);
+  __atomic_store_n(&slot->heartbeat_ns, now_ns(), __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->status, SLOT_DONE, __ATOMIC_RELEASE);
+}
+
+// Runs one transaction of a system, with its fixed kernel or open_and_write.
+// Returns 0 when it was done, -1 when admission control shed it.
+int run_transaction(int semSet, int ** shm_ary, int system) {
+  if(!started_txn) {
+    uint64_t none = 0;
+    __atomic_compare_exchange_n(&startup->first_txn_ns, &none, now_ns(), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    started_txn = true;
+  }
+  __atomic_store_n(&slot->system, system, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->txn, slot->txn + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->heartbeat_ns, now_ns(), __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->status, SLOT_RUNNING, __ATOMIC_RELEASE);
+  int result;
+  if(single_pct > 0 && single_due()) result = append_single(system);
+  else if(read_pct > 0 && read_due()) result = read_transaction(semSet, shm_ary, system);
+  else if(fixed_topology) result = fixed_kernels[system](semSet, shm_ary);
+  else result = open_and_write(semSet, shm_ary, system);
+  __atomic_store_n(&slot->heartbeat_ns, now_ns(), __ATOMIC_RELAXED);
+  return result;
+}
+
+// Whether the transaction this worker starts now is a single-record one,
+// spreading them evenly over its transactions
+bool single_due() {
+  single_seen++;
+  return single_seen * single_pct / 100 > (single_seen - 1) * single_pct / 100;
+}
+
+// Runs a single-record transaction of system i (see single_pct): its record
+// is appended to the system's first database without taking any lock
+int append_single(int i) {
+  int db = topology[i].db1;
+  if(append_fds[db] == -1) {
+    append_fds[db] = open(db_filenames[db], O_WRONLY | O_CREAT | O_APPEND, SHM_MODE);
+    if(append_fds[db] == -1) {
+      perror("can't open database to append to it");
+      exit(-1);
+    }
+  }
+  if(single_lens[i] == 0) {
+    single_lens[i] = snprintf(single_records[i], RECORD_SIZE, "Appended by %s (pid: %d)\n", topology[i].name, getpid());
+  }
+  simulate_work();
+  throttle_write(db, single_lens[i]);
+  if(write(append_fds[db], single_records[i], single_lens[i]) != single_lens[i]) {
+    perror("write error");
+  }
+  appended_txns++;
+  return 0;
+}
+
+// Whether the transaction this worker starts now is a read transaction,
+// spreading them evenly over its transactions
+bool read_due() {
+  reads_seen++;
+  return reads_seen * read_pct / 100 > (reads_seen - 1) * read_pct / 100;
+}
+
+// Runs a read transaction of system i (see read_pct): reads the last record
+// of its first database, from the database itself or from its least loaded
+// replica, while holding it for the simulated work
+int read_transaction(int semSet, int ** shm_ary, int i) {
+  int db = topology[i].db1;
+  char last[RECORD_SIZE];
+  bool whole;
+  uint64_t start = now_ns();
+  if(replica_count == 0) {
+    for(int attempt = 0; !acquire_tracked(semSet, shm_ary, db, i); attempt++) back_off(attempt);
+    claim_resource(shm_ary, db, i);
+    __atomic_fetch_add(&reads->read_wait_ns, now_ns() - start, __ATOMIC_RELAXED);
+    int fd = open(db_filenames[db], O_RDONLY);
+    // with staged writes, the bytes past the high-water mark may still be a hole
+    uint64_t end = tails != NULL ? __atomic_load_n(&tails[db].high_water, __ATOMIC_ACQUIRE) : UINT64_MAX;
+    whole = read_last_record(fd, last, end);
+    if(fd != -1) close(fd);
+    simulate_work();
+    *shm_ary[db] = 0;
+    release_database(semSet, db);
+    __atomic_fetch_add(&reads->primary_reads, 1, __ATOMIC_RELAXED);
+  }
+  else {
+    int k = pick_replica(db);
+    struct replica_load * replica = &reads->replicas[db][k];
+    __atomic_fetch_add(&replica->load, 1, __ATOMIC_RELAXED);
+    struct sembuf sem = make_sem_op(REPLICA_SEM(db, k), -1);
+    while(logged_semop(semSet, &sem, 1) == -1 && errno == EINTR);
+    __atomic_fetch_add(&reads->read_wait_ns, now_ns() - start, __ATOMIC_RELAXED);
+    whole = read_last_record(replica_fd(db, k), last, UINT64_MAX);
+    simulate_work();
+    sem.sem_op = 1;
+    logged_semop(semSet, &sem, 1);
+    __atomic_fetch_sub(&replica->load, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&replica->reads, 1, __ATOMIC_RELAXED);
+  }
+  if(!whole) __atomic_fetch_add(&reads->stale, 1, __ATOMIC_RELAXED);
+  if(!quiet) cout << topology[i].name << " (pid: " << getpid() << ") read \"" << last << "\" from " << db_filenames[db] << endl;
+  return 0;
+}
+
+// The replica of database db with the least load, and of those the one
+// that has served the fewest reads, so that ties are spread out
+int pick_replica(int db) {
+  int best = 0;
+  long least = __atomic_load_n(&reads->replicas[db][0].load, __ATOMIC_RELAXED);
+  long fewest = __atomic_load_n(&reads->replicas[db][0].reads, __ATOMIC_RELAXED);
+  for(int k = 1; k < replica_count; k++) {
+    long load = __atomic_load_n(&reads->replicas[db][k].load, __ATOMIC_RELAXED);
+    long served = __atomic_load_n(&reads->replicas[db][k].reads, __ATOMIC_RELAXED);
+    if(load < least || (load == least && served < fewest)) {
+      best = k;
+      least = load;
+      fewest = served;
+    }
+  }
+  return best;
+}
+
+// The file descriptor of replica k of database db in this worker
+int replica_fd(int db, int k) {
+  if(replica_fds[db][k] == -1) {
+    replica_fds[db][k] = open(replica_name(db, k).c_str(), O_RDWR | O_CREAT | O_APPEND, SHM_MODE);
+    if(replica_fds[db][k] == -1) {
+      perror("can't open replica");
+      exit(-1);
+    }
+  }
+  return replica_fds[db][k];
+}
+
+// Reads the last record of a database file, among its first end bytes,
+// into last. Returns false when it is not the end of a whole transaction:
+// cut short, or a transaction's first record without its last.
+bool read_last_record(int fd, char * last, uint64_t end) {
+  char tail[2 * RECORD_SIZE];
+  struct stat st;
+  last[0] = '\0';
+  if(fd == -1 || fstat(fd, &st) == -1) return true;
+  if((uint64_t) st.st_size > end) st.st_size = end;
+  if(st.st_size == 0) return true;
+  off_t from = st.st_size > (off_t) sizeof(tail) ? st.st_size - sizeof(tail) : 0;
+  ssize_t len = pread(fd, tail, st.st_size - from, from);
+  if(len <= 0 || tail[len - 1] != '\n') return false;
+  ssize_t begin = len - 1;
+  while(begin > 0 && tail[begin - 1] != '\n') begin--;
+  ssize_t size = len - 1 - begin < RECORD_SIZE - 1 ? len - 1 - begin : RECORD_SIZE - 1;
+  memcpy(last, tail + begin, size);
+  last[size] = '\0';
+  return strncmp(last, "Being used by ", 14) != 0;
+}
+
+// Takes the replication tickets of the transaction of system i in both its
+// databases, which it still holds, so that it replicates in their order
+void take_replica_tickets(int i, uint64_t * tickets) {
+  tickets[0] = __atomic_fetch_add(&reads->next_ticket[topology[i].db1], 1, __ATOMIC_RELAXED);
+  tickets[1] = __atomic_fetch_add(&reads->next_ticket[topology[i].db2], 1, __ATOMIC_RELAXED);
+}
+
+// Appends the records of the transaction of system i to every replica of
+// both its databases, after releasing them: each replica in turn, once the
+// transactions with the earlier tickets are on it, while holding its
+// semaphore so that no read sees the records half written
+void replicate(int semSet, int i, uint64_t * tickets) {
+  char records[2 * RECORD_SIZE];
+  int pid = getpid();
+  int len = snprintf(records, sizeof(records), "Being used by %s (pid:%d)\nFree from the %s (pid: %d)\n",
+                     topology[i].name, pid, topology[i].name, pid);
+  int dbs[2] = { topology[i].db1, topology[i].db2 };
+  for(int d = 0; d < 2; d++) {
+    for(int k = 0; k < replica_count; k++) {
+      struct replica_load * replica = &reads->replicas[dbs[d]][k];
+      while(__atomic_load_n(&replica->applied, __ATOMIC_ACQUIRE) != tickets[d]) sched_yield();
+      struct sembuf sem = make_sem_op(REPLICA_SEM(dbs[d], k), -1);
+      while(logged_semop(semSet, &sem, 1) == -1 && errno == EINTR);
+      if(write(replica_fd(dbs[d], k), records, len) != len) perror("write error");
+      sem.sem_op = 1;
+      logged_semop(semSet, &sem, 1);
+      __atomic_store_n(&replica->applied, tickets[d] + 1, __ATOMIC_RELEASE);
+    }
+  }
+  __atomic_fetch_add(&reads->replications, 1, __ATOMIC_RELAXED);
+}
+
+// Name of the file of replica k of database db
+string replica_name(int db, int k) {
+  char name[256];
+  snprintf(name, sizeof(name), "%s.replica%d", db_filenames[db], k + 1);
+  return name;
+}
+
+// Brings the replicas of every database up to the database, all its
+// segments included, before the workers start
+bool seed_replicas() {
+  for(int db = 0; db < DB_COUNT; db++) {
+    string data;
+    if(!read_database(db_filenames[db], 0, UINT64_MAX, data)) return false;
+    for(int k = 0; k < replica_count; k++) {
+      string name = replica_name(db, k);
+      FILE * out = fopen(name.c_str(), "wb");
+      if(out == NULL) return false;
+      bool written = fwrite(data.data(), 1, data.size(), out) == data.size();
+      if(fclose(out) != 0 || !written) return false;
+    }
+  }
+  return true;
+}
+
+// Prints where the read transactions read from, and how the replicas
+// shared them out
+void print_replica_report() {
+  long total = reads->primary_reads;
+  for(int db = 0; db < DB_COUNT; db++) {
+    for(int k = 0; k < replica_count; k++) total += reads->replicas[db][k].reads;
+  }
+  cout << "Reads: " << total << " read transactions, " << reads->primary_reads << " of them from the databases, waited "
+       << reads->read_wait_ns / 1e9 << " s in all, " << reads->stale << " found a transaction half written" << endl;
+  for(int db = 0; db < DB_COUNT && replica_count > 0; db++) {
+    long db_reads = 0;
+    for(int k = 0; k < replica_count; k++) db_reads += reads->replicas[db][k].reads;
+    if(db_reads == 0) continue;
+    cout << "  " << db_filenames[db] << " replicas:";
+    for(int k = 0; k < replica_count; k++) cout << (k > 0 ? " / " : " ") << reads->replicas[db][k].reads;
+    cout << " reads" << endl;
+  }
+  if(replica_count > 0) {
+    cout << "  " << reads->replications << " commits replicated to " << replica_count << " replicas of each database" << endl;
+  }
+}
+
+// Takes the comma separated directories of --partition-dirs
+bool parse_partition_dirs(char * list) {
+  partition_dir_count = 0;
+  for(char * dir = strtok(list, ","); dir != NULL; dir = strtok(NULL, ",")) {
+    if(partition_dir_count == MAX_PARTITION_DIRS) return false;
+    partition_dirs[partition_dir_count++] = dir;
+  }
+  if(partition_dir_count == 0) partition_dirs[partition_dir_count++] = ".";
+  return true;
+}
+
+// Path of partition p of database db: the directories take the
+// partitions in turn
+string partition_path(int db, int p) {
+  char name[512];
+  snprintf(name, sizeof(name), "%s/%s.part%d", partition_dirs[p % partition_dir_count], db_filenames[db], p);
+  return name;
+}
+
+// The partition of database db for the transaction this worker is on:
+// its key, hashed with the database
+int partition_of(int db) {
+  uint32_t key = ((uint32_t) worker_id << 20) ^ ((uint32_t) partition_txns << 3) ^ db;
+  return (key * 2654435761u >> 16) % partition_count;
+}
+
+// Acquires, for the transaction of system i, its partition of both of its
+// databases, and its admission unless admission control or the admission
+// pools gave it already, all in one semop. When that has to wait, the wait
+// is split between the systems holding the two partitions.
+void acquire_partitions(int semSet, int i) {
+  const system_desc & sys = topology[i];
+  partition_txns++;
+  int p1 = held_partition[sys.db1] = partition_of(sys.db1);
+  int p2 = held_partition[sys.db2] = partition_of(sys.db2);
+  struct sembuf ops[3];
+  int n = 0;
+  if(admission_bound == 0 && budget == NULL) ops[n++] = make_sem_op(ADMISSION_SEM, -1, SEM_UNDO | IPC_NOWAIT);
+  ops[n++] = make_sem_op(PARTITION_SEM(sys.db1, p1), -1, SEM_UNDO | IPC_NOWAIT);
+  ops[n++] = make_sem_op(PARTITION_SEM(sys.db2, p2), -1, SEM_UNDO | IPC_NOWAIT);
+  if(logged_semop(semSet, ops, n) == -1) {
+    int holders[2] = { partitions->owner[sys.db1][p1] - 1, partitions->owner[sys.db2][p2] - 1 };
+    double start = now_seconds();
+    for(int k = 0; k < n; k++) ops[k].sem_flg = SEM_UNDO;
+    slot_waiting();
+    while(logged_semop(semSet, ops, n) == -1 && errno == EINTR);
+    slot_running();
+    double waited = now_seconds() - start;
+    int busy = (holders[0] >= 0) + (holders[1] >= 0);
+    if(busy == 0) record_blocked(i, UNKNOWN_HOLDER, ADMISSION_SEM, waited);
+    if(holders[0] >= 0) record_blocked(i, holders[0], sys.db1, waited / busy);
+    if(holders[1] >= 0) record_blocked(i, holders[1], sys.db2, waited / busy);
+  }
+  int dbs[2] = { sys.db1, sys.db2 };
+  for(int d = 0; d < 2; d++) {
+    int p = held_partition[dbs[d]];
+    if(partitions->owner[dbs[d]][p] != 0) {
+      cout << "ERROR: Resources are in use!" << endl;
+      exit(-1);
+    }
+    partitions->owner[dbs[d]][p] = i + 1;
+  }
+  __atomic_fetch_add(&partitions->transactions, 1, __ATOMIC_RELAXED);
+  if(p1 != p2) __atomic_fetch_add(&partitions->crossed, 1, __ATOMIC_RELAXED);
+}
+
+// Sizes of the partition files, to tell how much the run wrote to them
+void measure_partitions(uint64_t bytes[][MAX_PARTITIONS]) {
+  for(int db = 0; db < DB_COUNT; db++) {
+    for(int p = 0; p < partition_count; p++) {
+      struct stat st;
+      bytes[db][p] = stat(partition_path(db, p).c_str(), &st) == 0 ? st.st_size : 0;
+    }
+  }
+}
+
+// Prints how much was written to the partitions in each directory, and
+// how fast
+void print_partition_report(double elapsed) {
+  uint64_t now[DB_COUNT][MAX_PARTITIONS];
+  measure_partitions(now);
+  cout << "Partitions: " << partition_count << " per database over " << partition_dir_count << " directories, "
+       << partitions->crossed << " of " << partitions->transactions << " transactions in two different partitions" << endl;
+  for(int dir = 0; dir < partition_dir_count && dir < partition_count; dir++) {
+    uint64_t written = 0;
+    for(int db = 0; db < DB_COUNT; db++) {
+      for(int p = dir; p < partition_count; p += partition_dir_count) written += now[db][p] - partition_bytes[db][p];
+    }
+    cout << "  " << partition_dirs[dir] << ": " << written / 1e6 << " MB written, "
+         << (elapsed > 0 ? written / 1e6 / elapsed : 0) << " MB/s" << endl;
+  }
+}
+
+// Queues the transactions of all the workers for pool mode, and returns
+// how many there are
+long fill_queue() {
+  long total = queued_count();
+  uint64_t start = now_ns();
+  memset(queue, 0, sizeof(struct txn_queue));
+  queue->count = total;
+  for(long k = 0; k < total; k++) {
+    struct txn * t = &queued_txns[k];
+    t->system = k % DB_COUNT;
+    t->state = TXN_PENDING;
+    t->arrival_ns = start + k * arrival_usec * 1000;
+    t->hold_usec = -1;
+    if(trace != NULL) {
+      t->system = trace[k].system;
+      t->arrival_ns = start + (uint64_t) (trace[k].arrival_usec * 1000 / trace_speed);
+      t->hold_usec = trace[k].hold_usec / trace_speed;
+    }
+    t->deadline_ns = deadline_ms[t->system] > 0 ? t->arrival_ns + deadline_ms[t->system] * 1000000 : 0;
+    if(t->deadline_ns != 0) queue->with_deadline++;
+  }
+  return total;
+}
+
+// Deadline of queued transaction k, UINT64_MAX when it has none
+uint64_t txn_deadline(long k) {
+  return queued_txns[k].deadline_ns != 0 ? queued_txns[k].deadline_ns : UINT64_MAX;
+}
+
+// Takes the next transaction to run off the queue, as chosen by the
+// scheduler (see txn_queue), waiting for it to arrive if need be.
+// Returns its index in the queue, or -1 once the queue is empty, or
+// -2 when none has arrived yet and wait is false. Transactions sharing
+// a database with system avoid (unless it is -1) are passed over.
+long take_transaction(int semSet, int ** shm_ary, bool wait, int avoid) {
+  for(;;) {
+    acquire_resource(semSet, QUEUE_SEM);
+    while(queue->head < queue->count && queued_txns[queue->head].state == TXN_TAKEN) queue->head++;
+    if(queue->head == queue->count) {
+      release_resource(semSet, QUEUE_SEM);
+      return -1;
+    }
+
+    uint64_t now = now_ns();
+    long earliest = -1; // earliest deadline
+    long earliest_free = -1; // earliest deadline whose databases are free
+    for(long k = queue->head; k < queue->count && k < queue->head + SCHED_WINDOW; k++) {
+      struct txn * t = &queued_txns[k];
+      if(t->state != TXN_PENDING) continue;
+      if(t->arrival_ns > now) break; // transactions arrive in queue order
+      if(avoid != -1 && shares_database(t->system, avoid)) continue;
+      if(schedule == POLICY_FIFO) {
+        earliest = k;
+        break;
+      }
+      if(t->deadline_ns != 0 && now + queue->service_ns > t->deadline_ns) {
+        queue->late++;
+        t->deadline_ns = 0;
+        if(reject_late) {
+          if(debug) cout << "Rejected transaction " << k << " that cannot make its deadline" << endl;
+          t->state = TXN_TAKEN;
+          continue;
+        }
+      }
+      uint64_t deadline = txn_deadline(k);
+      if(earliest == -1 || deadline < txn_deadline(earliest)) earliest = k;
+      if(*shm_ary[topology[t->system].db1] == 0 && *shm_ary[topology[t->system].db2] == 0) {
+        if(earliest_free == -1 || deadline < txn_deadline(earliest_free)) earliest_free = k;
+      }
+    }
+    long pick = earliest;
+    if(earliest_free != -1 && (queued_txns[earliest_free].deadline_ns != 0 || queued_txns[earliest].deadline_ns == 0)) {
+      pick = earliest_free;
+    }
+    uint64_t next_arrival = queued_txns[queue->head].arrival_ns;
+    if(pick != -1) queued_txns[pick].state = TXN_TAKEN;
+    release_resource(semSet, QUEUE_SEM);
+
+    if(pick != -1) return pick;
+    if(!wait) return -2;
+    // nothing has arrived yet (or all of it was rejected), so wait for it
+    if(next_arrival > now) usleep((next_arrival - now) / 1000);
+  }
+}
+
+// Whether the transactions of two systems need a database in common
+bool shares_database(int a, int b) {
+  return topology[a].db1 == topology[b].db1 || topology[a].db1 == topology[b].db2 ||
+         topology[a].db2 == topology[b].db1 || topology[a].db2 == topology[b].db2;
+}
+
+// Tries to acquire the admission and database semaphores of this worker's
+// next transaction in one non-blocking semop (see prefetch_state), and
+// marks the databases as used by its system when that works
+void try_prefetch(int semSet, int ** shm_ary) {
+  if(prefetch.system < 0 || prefetch.acquired) return;
+  const system_desc & sys = topology[prefetch.system];
+  struct sembuf ops[3] = {
+    make_sem_op(ADMISSION_SEM, -1, SEM_UNDO | IPC_NOWAIT),
+    make_sem_op(sys.db1, -1, SEM_UNDO | IPC_NOWAIT), make_sem_op(sys.db2, -1, SEM_UNDO | IPC_NOWAIT)
+  };
+  if(logged_semop(semSet, ops, 3) == 0) {
+    if(debug) cout << "Acquired the resources of system " << prefetch.system << " in advance" << endl;
+    claim_resource(shm_ary, sys.db1, prefetch.system);
+    claim_resource(shm_ary, sys.db2, prefetch.system);
+    prefetch.acquired = true;
+  }
+}
+
+// Called as a transaction of system i starts: whether its semaphores were
+// acquired in advance by try_prefetch, in which case they now belong to it.
+// From then on try_prefetch goes after the next transaction's semaphores.
+bool take_prefetched(int i) {
+  bool acquired = prefetch.acquired && prefetch.system == i;
+  if(acquired) prefetch.hits++;
+  prefetch.system = prefetch.next;
+  prefetch.next = -1;
+  prefetch.acquired = false;
+  return acquired;
+}
+
+// Accounts for a transaction of the queue that has completed: whether it
+// made its deadline, and whether it was the quickest one so far
+void finish_transaction(long k, uint64_t started) {
+  uint64_t done = now_ns();
+  struct txn * t = &queued_txns[k];
+  if(t->deadline_ns != 0) {
+    if(done <= t->deadline_ns) __atomic_fetch_add(&queue->met, 1, __ATOMIC_RELAXED);
+    else __atomic_fetch_add(&queue->missed, 1, __ATOMIC_RELAXED);
+  }
+  uint64_t took = done - started;
+  uint64_t quickest = __atomic_load_n(&queue->service_ns, __ATOMIC_RELAXED);
+  while((quickest == 0 || took < quickest) &&
+        !__atomic_compare_exchange_n(&queue->service_ns, &quickest, took, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Prints how well the transactions with a deadline did under the schedule
+void print_schedule_report() {
+  long misses = queue->missed + queue->late;
+  cout << "Schedule " << (schedule == POLICY_EDF ? "edf" : "fifo") << ": " << queue->count << " transactions, "
+       << queue->with_deadline << " with a deadline" << endl;
+  cout << "  met " << queue->met << ", missed " << queue->missed << ", "
+       << (reject_late ? "rejected " : "deferred ") << queue->late << endl;
+  if(queue->with_deadline > 0) {
+    cout << "  deadline miss rate " << 100.0 * misses / queue->with_deadline << "%" << endl;
+  }
+}
+
+// Opens the performance counters of this process (disabled), falling back
+// to the software event of a counter when its hardware event is unavailable,
+// then enables them all. fds[c] is -1 for a counter that could not be opened,
+// and sources[c] tells which event was opened (see worker_slot).
+void open_perf_counters(int * fds, int * sources) {
+  for(int c = 0; c < PERF_COUNTERS; c++) {
+    fds[c] = -1;
+    sources[c] = 0;
+    for(int source = 1; source <= 2 && fds[c] == -1; source++) {
+      if(source == 2 && perf_counters[c].fallback_name == NULL) break;
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = source == 1 ? perf_counters[c].type : perf_counters[c].fallback_type;
+      attr.config = source == 1 ? perf_counters[c].config : perf_counters[c].fallback_config;
+      attr.disabled = 1;
+      attr.exclude_hv = 1;
+      // context switches and page faults happen in the kernel, so try to
+      // count it too, but user space alone is all perf_event_paranoid 2 allows
+      fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      if(fds[c] == -1) {
+        attr.exclude_kernel = 1;
+        fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+      if(fds[c] != -1) sources[c] = source;
+    }
+    if(debug) cout << "Counter " << perf_counters[c].name << " source: " << sources[c] << endl;
+  }
+  for(int c = 0; c < PERF_COUNTERS; c++) {
+    if(fds[c] != -1) ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+// Disables and reads the performance counters of this process into the
+// worker's slot, and closes them
+void read_perf_counters(int * fds, int * sources, struct worker_slot * slot) {
+  for(int c = 0; c < PERF_COUNTERS; c++) {
+    if(fds[c] == -1) continue;
+    uint64_t value = 0;
+    ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+    if(read(fds[c], &value, sizeof(value)) == sizeof(value)) {
+      slot->value[c] = value;
+      slot->source[c] = sources[c];
+    }
+    close(fds[c]);
+  }
+}
+
+// Aggregates the slots of all workers and prints them along with the
+// configuration that was measured
+void print_bench_report(struct worker_slot * slots, double elapsed) {
+  long transactions = 0;
+  long pipelined = 0;
+  long appended = 0;
+  uint64_t totals[PERF_COUNTERS] = { 0 };
+  int sources[PERF_COUNTERS] = { 0 };
+  for(int w = 0; w < worker_count; w++) {
+    transactions += slots[w].transactions;
+    pipelined += slots[w].pipelined;
+    appended += slots[w].appended;
+    for(int c = 0; c < PERF_COUNTERS; c++) {
+      totals[c] += slots[w].value[c];
+      if(slots[w].source[c] > sources[c]) sources[c] = slots[w].source[c];
+    }
+  }
+
+  const char * locks[] = { "sysv", "ofd", "ofd-record" };
+  cout << "Benchmark: kernel=" << (fixed_topology ? "fixed" : "runtime") << " locks=" << locks[lock_backend]
+       << " workers=" << worker_count << " transactions=" << transactions
+       << " work-usec=" << work_usec << endl;
+  cout << "  elapsed " << elapsed << " s, " << transactions / elapsed << " transactions/s" << endl;
+  cout << "  startup (" << (spawn_workers ? "spawn" : "fork") << (fast_start ? ", fast" : "") << "): first transaction after "
+       << (startup->first_txn_ns - startup->launched_ns) / 1e6 << " ms, all workers ready after "
+       << (startup->all_ready_ns - startup->launched_ns) / 1e6 << " ms" << endl;
+  if(pipeline) cout << "  " << pipelined << " transactions had their resources acquired in advance" << endl;
+  if(single_pct > 0) cout << "  " << appended << " single-record transactions appended without locks" << endl;
+  for(int c = 0; c < PERF_COUNTERS; c++) {
+    if(sources[c] == 0) {
+      cout << "  " << perf_counters[c].name << ": unavailable" << endl;
+      continue;
+    }
+    const char * name = sources[c] == 2 ? perf_counters[c].fallback_name : perf_counters[c].name;
+    cout << "  " << name << ": " << totals[c];
+    if(transactions > 0) cout << " (" << (double) totals[c] / transactions << " per transaction)";
+    cout << endl;
+  }
+
+  // memory per worker, the pages it has of its own above all
+  struct memory_usage sum = { 0, 0, 0, 0 };
+  long max_private = 0;
+  int sampled = 0;
+  for(int w = 0; w < worker_count; w++) {
+    if(slots[w].memory.rss_kb == 0) continue;
+    sum.rss_kb += slots[w].memory.rss_kb;
+    sum.pss_kb += slots[w].memory.pss_kb;
+    sum.private_kb += slots[w].memory.private_kb;
+    sum.shared_kb += slots[w].memory.shared_kb;
+    if(slots[w].memory.private_kb > max_private) max_private = slots[w].memory.private_kb;
+    sampled++;
+  }
+  if(sampled == 0) {
+    cout << "  memory per worker: unavailable" << endl;
+    return;
+  }
+  cout << "  memory per worker (" << (lean_fork ? "lean fork" : spawn_workers ? "spawn" : "fork") << "): private "
+       << sum.private_kb / sampled << " kB (max " << max_private << " kB), shared " << sum.shared_kb / sampled
+       << " kB, pss " << sum.pss_kb / sampled << " kB, rss " << sum.rss_kb / sampled << " kB" << endl;
+  cout << "  memory of all workers: private " << sum.private_kb << " kB, pss " << sum.pss_kb << " kB" << endl;
+}
+
+// Reads the memory of a process from its smaps_rollup file. Reads it with
+// a buffer on the stack, so that measuring dirties no heap page of its own.
+bool read_memory_usage(const char * path, struct memory_usage * usage) {
+  char buf[4096];
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) return false;
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(len <= 0) return false;
+  buf[len] = '\0';
+
+  memset(usage, 0, sizeof(struct memory_usage));
+  for(char * line = buf; line != NULL && *line != '\0'; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+    long kb;
+    if(sscanf(line, "Rss: %ld", &kb) == 1) usage->rss_kb = kb;
+    else if(sscanf(line, "Pss: %ld", &kb) == 1) usage->pss_kb = kb;
+    else if(sscanf(line, "Shared_Clean: %ld", &kb) == 1) usage->shared_kb += kb;
+    else if(sscanf(line, "Shared_Dirty: %ld", &kb) == 1) usage->shared_kb += kb;
+    else if(sscanf(line, "Private_Clean: %ld", &kb) == 1) usage->private_kb += kb;
+    else if(sscanf(line, "Private_Dirty: %ld", &kb) == 1) usage->private_kb += kb;
+  }
+  return usage->rss_kb > 0;
+}
+
+// Returns the monotonic clock in seconds
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the monotonic clock in nanoseconds
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Waits, if the rate limits require it, until a write of this many bytes
+// may be issued to database db
+void throttle_write(int db, size_t bytes) {
+  if(rate_bytes > 0) take_tokens(&buckets[db].bytes_full_ns, rate_bytes, bytes, &buckets[db].throttled_ns);
+  if(rate_ops > 0) take_tokens(&buckets[db].ops_full_ns, rate_ops, 1, &buckets[db].throttled_ns);
+}
+
+// Takes amount tokens from a bucket refilled at rate tokens per second (see
+// file_buckets), then sleeps for as long as the bucket is overdrawn
+void take_tokens(uint64_t * full_ns, double rate, double amount, uint64_t * throttled_ns) {
+  uint64_t cost = (uint64_t) (amount * 1e9 / rate);
+  uint64_t burst = (uint64_t) (RATE_BURST_SEC * 1e9);
+  if(burst < cost) burst = cost; // a single write bigger than the burst still goes through
+  uint64_t now = now_ns();
+  uint64_t full = __atomic_load_n(full_ns, __ATOMIC_RELAXED);
+  uint64_t next;
+  do {
+    next = (full > now ? full : now) + cost;
+  } while(!__atomic_compare_exchange_n(full_ns, &full, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  if(next > now + burst) {
+    uint64_t wait = next - now - burst;
+    __atomic_fetch_add(throttled_ns, wait, __ATOMIC_RELAXED);
+    struct timespec ts = { (time_t) (wait / 1000000000ULL), (long) (wait % 1000000000ULL) };
+    nanosleep(&ts, NULL);
+  }
+}
+
+// Size in bytes of a record of the runtime path, eg. "Free from the X (pid: 123)\n"
+size_t record_size(const char * head, const char * name, const char * tail) {
+  return snprintf(NULL, 0, "%s%s%s%d)\n", head, name, tail, getpid());
+}
+
+// Prints how long the rate limits held back writes to each database file
+void print_throttling() {
+  cout << "Rate limiting:" << endl;
+  for(int db = 0; db < DB_COUNT; db++) {
+    cout << "  " << db_filenames[db] << " writes delayed " << buckets[db].throttled_ns / 1e9 << " s" << endl;
+  }
+}
+
+// Holds on to the databases for a while to simulate the database action
+void simulate_work() {
+  long usec = txn_hold_usec >= 0 ? txn_hold_usec : work_usec;
+  struct timespec left = { usec / 1000000, (usec % 1000000) * 1000 };
+  // a timer wakeup (see timer_wheel) must not cut it short
+  while(usec > 0 && nanosleep(&left, &left) == -1 && errno == EINTR);
+}
+
+// Opens a file, after acquiring the semaphore with that particular resource,
+// then write to shared memory to doubly represent that the file is use
+// This shared memory is used as a monitor for the access status
+// of the file (0 = free, otherwise 1 + the system using it). After writing to memory, it will write to the files,
+// and rewrite the shared memory to 0 (free), then release the semaphore to show the resource
+// is now free for another process to use.
+// Returns 0 once done, or -1 when admission control shed the transaction.
+int open_and_write(int semSet, int ** shm_ary, int i) {
+  //calculate the values of the resources required
+  int sem1 = i;
+  int sem2 = (i + 1 == 5) ? 0 : i + 1;
+
+  ofstream db1;
+  ofstream db2;
+  const char * db1filename;
+  const char * db2filename;
+  const char * systemName;
+
+  // Acquire the required resources to do the database transaction
+  if(take_prefetched(i)) {
+    if(debug) cout << "Resources of system " << i << " were acquired in advance" << endl;
+  }
+  else if(partitions != NULL) {
+    if(admission_bound > 0) {
+      if(!admit(semSet, i)) return -1; // shed: fail fast, with nothing acquired
+    }
+    else if(budget != NULL) {
+      pool_admit(i);
+    }
+    acquire_partitions(semSet, i);
+  }
+  else {
+    // with timed acquisitions, a transaction that doesn't get its databases
+    // in time lets go of everything, backs off and starts over
+    for(int attempt = 0; ; attempt++) {
+      if(admission_bound > 0) {
+        if(!admit(semSet, i)) return -1; // shed: fail fast, with nothing acquired
+      }
+      else if(budget != NULL) {
+        pool_admit(i);
+      }
+      else {
+        acquire_tracked(semSet, shm_ary, 5, i); // get to be one of the four processes that can access files
+      }
+      // file locks are taken in database order, so that they can't deadlock
+      int first = lock_backend != LOCKS_SYSV && sem2 < sem1 ? sem2 : sem1;
+      int second = first == sem1 ? sem2 : sem1;
+      if(wheel != NULL) arm_timer(acquire_timeout_usec);
+      if(acquire_tracked(semSet, shm_ary, first, i)) { //get access to the first database
+        claim_resource(shm_ary, first, i);
+        if(acquire_tracked(semSet, shm_ary, second, i)) { // get access to the second database
+          claim_resource(shm_ary, second, i);
+          if(wheel != NULL) cancel_timer();
+          break;
+        }
+        *shm_ary[first] = 0;
+        release_database(semSet, first);
+      }
+      leave_admission(semSet);
+      back_off(attempt);
+    }
+  }
+  if(parallel != NULL) enter_parallel();
+
+  //Switch through all the different systems and the databases they need
+  switch(i) {
+    //Courses System
+    case 0:
+      systemName = "Courses System";
+      db1filename = "faculty.txt";
+      db2filename = "students.txt";
+    break;
+    //GPA Computation System
+    case 1:
+      systemName = "GPA Computation System";
+      db1filename = "students.txt";
+      db2filename = "statistics.txt";
+    break;
+    //University Stats System
+    case 2:
+      systemName = "University Statistics System";
+      db1filename = "statistics.txt";
+      db2filename = "staff.txt";
+    break;
+    //Staff Management System
+    case 3:
+      systemName = "Staff Management System";
+      db1filename = "staff.txt";
+      db2filename = "salary.txt";
+    break;
+    //Faculty Payroll System
+    case 4:
+      systemName = "Faculty Payroll System";
+      db1filename = "salary.txt";
+      db2filename = "faculty.txt";
+    break;
+  }
+
+  // a partitioned database is written in the partition the transaction holds
+  string partition1;
+  string partition2;
+  if(partitions != NULL) {
+    partition1 = partition_path(sem1, held_partition[sem1]);
+    partition2 = partition_path(sem2, held_partition[sem2]);
+    db1filename = partition1.c_str();
+    db2filename = partition2.c_str();
+  }
+
+  // with staged writes, only reserve room for the records while holding the
+  // databases, and write them once they are released
+  if(staged_writes) {
+    char staged1[2 * RECORD_SIZE];
+    char staged2[2 * RECORD_SIZE];
+    int pid = getpid();
+    int len1 = snprintf(staged1, sizeof(staged1), "Being used by %s (pid:%d)\nFree from the %s (pid: %d)\n", systemName, pid, systemName, pid);
+    int len2 = snprintf(staged2, sizeof(staged2), "Being used by %s (pid:%d)\nFree from the %s (pid: %d)\n", systemName, pid, systemName, pid);
+    uint64_t ticket1;
+    uint64_t ticket2;
+    uint64_t offset1 = reserve_tail(sem1, len1, &ticket1);
+    uint64_t offset2 = reserve_tail(sem2, len2, &ticket2);
+    simulate_work();
+    simulate_work();
+    if(store != NULL) publish_versions(sem1, sem2, systemName);
+    if(parallel != NULL) leave_parallel(i);
+    *shm_ary[sem1] = 0;
+    release_database(semSet, sem1);
+    *shm_ary[sem2] = 0;
+    release_database(semSet, sem2);
+    leave_admission(semSet);
+
+    write_staged(sem1, staged1, len1, offset1);
+    write_staged(sem2, staged2, len2, offset2);
+    publish_staged(sem1, ticket1, offset1 + len1);
+    publish_staged(sem2, ticket2, offset2 + len2);
+    if(!quiet) cout << systemName << " (pid: " << pid << ") wrote to " << db1filename << " and " << db2filename << " after releasing them" << endl;
+    return 0;
+  }
+
+  // open files once we have acquired both semaphores. Their buffers are on
+  // the stack rather than the heap, which a forked worker would copy.
+  // With --lean-fork the files are written with write(2) instead, so the
+  // worker touches no iostream state either.
+  char db1buf[BUFSIZ];
+  char db2buf[BUFSIZ];
+  int fd1 = -1;
+  int fd2 = -1;
+  if(lean_fork) {
+    fd1 = open(db1filename, O_WRONLY | O_CREAT | O_APPEND, SHM_MODE);
+    fd2 = open(db2filename, O_WRONLY | O_CREAT | O_APPEND, SHM_MODE);
+  }
+  else {
+    db1.rdbuf()->pubsetbuf(db1buf, sizeof(db1buf));
+    db2.rdbuf()->pubsetbuf(db2buf, sizeof(db2buf));
+    db1.open(db1filename, ofstream::out | ofstream::app);
+    db2.open(db2filename, ofstream::out | ofstream::app);
+  }
+
+  // do all work with databases in here while you have access
+  if(!quiet) cout << systemName << " (pid: " << getpid() << ") writing to " << db1filename << endl;
+  append_record(db1, fd1, sem1, "Being used by ", systemName, " (pid:");
+  simulate_work();
+  try_prefetch(semSet, shm_ary); // the next transaction's resources, if they are free
+  if(!quiet) cout << systemName << " (pid: " << getpid() << ") writing to " << db2filename << endl;
+  append_record(db2, fd2, sem2, "Being used by ", systemName, " (pid:");
+  simulate_work();
+  try_prefetch(semSet, shm_ary);
+  append_record(db1, fd1, sem1, "Free from the ", systemName, " (pid: ");
+  append_record(db2, fd2, sem2, "Free from the ", systemName, " (pid: ");
+  if(store != NULL) publish_versions(sem1, sem2, systemName);
+  uint64_t replica_tickets[2];
+  if(replica_count > 0) take_replica_tickets(i, replica_tickets);
+  if(parallel != NULL) leave_parallel(i);
+
+  //close resource, rewrite shared memory to 0, and release resource from semaphore
+  if(lean_fork) close(fd1);
+  else db1.close();
+  if(seal_bytes > 0) maybe_seal(sem1);
+  if(debug) cout << "Writing 0 to shared memory space for resource " << sem1 << " (now free)" << endl;
+  *shm_ary[sem1] = 0; //set shared memory to 0 to show that that resource is available now
+  release_database(semSet, sem1); //release semaphore so another process can acquire it
+  if(!quiet) cout << systemName << " (pid: " << getpid() << ") freed up access to " << db1filename << endl;
+
+  if(lean_fork) close(fd2);
+  else db2.close();
+  if(seal_bytes > 0) maybe_seal(sem2);
+  if(debug) cout << "Writing 0 to shared memory space for resource " << sem2 << " (now free)" << endl;
+  *shm_ary[sem2] = 0; //set shared memory to 0 to show that that resource is available now
+  release_database(semSet, sem2); //release semaphore so another process can acquire it
+  if(!quiet) cout << systemName << " (pid: " << getpid() << ") freed up access to " << db2filename << endl;
+  if(replica_count > 0) replicate(semSet, i, replica_tickets);
+  leave_admission(semSet);
+  return 0;
+}
+
+// Appends one record to database db: the prefix, then the pid of this
+// process and a closing bracket, all in a single write
+void write_record(int fd, int db, const char * prefix, int len) {
+  char record[96];
+  memcpy(record, prefix, len);
+  len += snprintf(record + len, sizeof(record) - len, "%d)\n", getpid());
+  throttle_write(db, len);
+  if(write(fd, record, len) != len) {
+    perror("write error");
+  }
+}
+
+// Appends the record "<head><system name><tail><pid>)" to a database,
+// through its stream, or through its file descriptor when it has one
+void append_record(ofstream & db, int fd, int sem, const char * head, const char * name, const char * tail) {
+  if(fd != -1) {
+    char prefix[96];
+    int len = snprintf(prefix, sizeof(prefix), "%s%s%s", head, name, tail);
+    write_record(fd, sem, prefix, len);
+    return;
+  }
+  throttle_write(sem, record_size(head, name, tail));
+  db << head << name << tail << getpid()  << ")" << endl;
+}
+
+// Acquires a semaphore for system i like acquire_resource does, but when it
+// is not available right away the time spent blocked is recorded against
+// the system holding it (from its ownership word) in the blocked-by matrices.
+// Returns false when the timer of a timed acquisition (see timer_wheel) ran
+// out first.
+bool acquire_tracked(int semSet, int ** shm_ary, int semid, int i) {
+  if(lock_backend != LOCKS_SYSV && semid < DB_COUNT) {
+    acquire_file_lock(shm_ary, semid, i);
+    return true;
+  }
+  if(split != NULL && semid < DB_COUNT) {
+    acquire_split(semSet, shm_ary, semid, i);
+    return true;
+  }
+  struct sembuf sem = make_sem_op(semid, -1);
+  sem.sem_flg |= IPC_NOWAIT;
+  if(logged_semop(semSet, &sem, 1) == 0) {
+    if(debug) cout << "Semaphore " << semid << " acquired without waiting" << endl;
+    return true;
+  }
+  int holder = semid < DB_COUNT ? *shm_ary[semid] - 1 : -1;
+  double start = now_seconds();
+  bool acquired = true;
+  slot_waiting();
+  if(events != NULL && semid < DB_COUNT) acquired = event_acquire(semSet, semid, true);
+  else if(wheel != NULL && semid < DB_COUNT) acquired = timed_acquire(semSet, semid);
+  else acquire_resource(semSet, semid);
+  slot_running();
+  record_blocked(i, holder >= 0 ? holder : UNKNOWN_HOLDER, semid, now_seconds() - start);
+  return acquired;
+}
+
+// Marks a database that was just acquired as used by system i in its
+// ownership word (1 + i), checking that nobody else had it
+void claim_resource(int ** shm_ary, int res, int i) {
+  // a striped or record lock has several holders
+  if(held_stripe[res] >= 0 || lock_backend == LOCKS_OFD_RECORD) return;
+  if(*shm_ary[res] == 0) {
+    if(debug) cout << "Writing " << i + 1 << " to shared memory space for resource " << res << " (now busy)" << endl;
+    *shm_ary[res] = i + 1; // show that the file is busy, and who is using it
+  }
+  else {
+    cout << "ERROR: Resources are in use!" << endl;
+    exit(-1);
+  }
+}
+
+// Adds a wait of system i, behind holder, on a resource to the blocked-by matrices
+void record_blocked(int i, int holder, int res, double seconds) {
+  uint64_t ns = (uint64_t) (seconds * 1e9);
+  __atomic_fetch_add(&blocking->by_system_ns[i][holder], ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&blocking->by_system_waits[i][holder], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&blocking->by_resource_ns[i][res], ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&blocking->by_resource_waits[i][res], 1, __ATOMIC_RELAXED);
+}
+
+// Name of a column of the blocked-by matrices
+const char * holder_name(int holder) {
+  return holder == UNKNOWN_HOLDER ? "(unknown)" : topology[holder].name;
+}
+
+const char * resource_name(int res) {
+  return res == ADMISSION_SEM ? "(admission)" : db_filenames[res];
+}
+
+// Prints, for every system that had to wait, how its waiting time was
+// shared out between the systems it waited behind and the resources
+void print_blocked_by() {
+  cout << "Blocked-by (share of each system's waiting time):" << endl;
+  for(int i = 0; i < DB_COUNT; i++) {
+    uint64_t total = 0;
+    for(int res = 0; res < RESOURCE_COUNT; res++) total += blocking->by_resource_ns[i][res];
+    if(total == 0) continue;
+    cout << "  " << topology[i].name << " waited " << total / 1e9 << " s" << endl;
+    for(int holder = 0; holder <= DB_COUNT; holder++) {
+      if(blocking->by_system_ns[i][holder] == 0) continue;
+      cout << "    " << 100.0 * blocking->by_system_ns[i][holder] / total << "% behind "
+           << holder_name(holder) << " (" << blocking->by_system_waits[i][holder] << " waits)" << endl;
+    }
+    for(int res = 0; res < RESOURCE_COUNT; res++) {
+      if(blocking->by_resource_ns[i][res] == 0) continue;
+      cout << "    " << 100.0 * blocking->by_resource_ns[i][res] / total << "% on "
+           << resource_name(res) << " (" << blocking->by_resource_waits[i][res] << " waits)" << endl;
+    }
+  }
+}
+
+// Writes the blocked-by matrices in the textfile format of the node exporter.
+// The file is written next to its final name and renamed into place so
+// that a collector never reads half of it.
+void write_metrics(const char * filename) {
+  string tmpname = string(filename) + ".tmp";
+  ofstream out(tmpname.c_str());
+  out << "# HELP sem_and_share_blocked_seconds_total Time a system waited behind another system." << endl;
+  out << "# TYPE sem_and_share_blocked_seconds_total counter" << endl;
+  for(int i = 0; i < DB_COUNT; i++) {
+    for(int holder = 0; holder <= DB_COUNT; holder++) {
+      out << "sem_and_share_blocked_seconds_total{system=\"" << topology[i].name << "\",holder=\""
+          << holder_name(holder) << "\"} " << blocking->by_system_ns[i][holder] / 1e9 << endl;
+    }
+  }
+  out << "# HELP sem_and_share_blocked_waits_total Blocking acquires of a system behind another system." << endl;
+  out << "# TYPE sem_and_share_blocked_waits_total counter" << endl;
+  for(int i = 0; i < DB_COUNT; i++) {
+    for(int holder = 0; holder <= DB_COUNT; holder++) {
+      out << "sem_and_share_blocked_waits_total{system=\"" << topology[i].name << "\",holder=\""
+          << holder_name(holder) << "\"} " << blocking->by_system_waits[i][holder] << endl;
+    }
+  }
+  out << "# HELP sem_and_share_resource_blocked_seconds_total Time a system waited on a resource." << endl;
+  out << "# TYPE sem_and_share_resource_blocked_seconds_total counter" << endl;
+  for(int i = 0; i < DB_COUNT; i++) {
+    for(int res = 0; res < RESOURCE_COUNT; res++) {
+      out << "sem_and_share_resource_blocked_seconds_total{system=\"" << topology[i].name << "\",resource=\""
+          << resource_name(res) << "\"} " << blocking->by_resource_ns[i][res] / 1e9 << endl;
+    }
+  }
+  if(bench) {
+    out << "# HELP sem_and_share_worker_private_bytes Memory a worker does not share with any other process." << endl;
+    out << "# TYPE sem_and_share_worker_private_bytes gauge" << endl;
+    for(int w = 0; w < worker_count; w++) {
+      out << "sem_and_share_worker_private_bytes{worker=\"" << w << "\"} " << slots[w].memory.private_kb * 1024 << endl;
+    }
+    out << "# HELP sem_and_share_worker_pss_bytes Proportional set size of a worker." << endl;
+    out << "# TYPE sem_and_share_worker_pss_bytes gauge" << endl;
+    for(int w = 0; w < worker_count; w++) {
+      out << "sem_and_share_worker_pss_bytes{worker=\"" << w << "\"} " << slots[w].memory.pss_kb * 1024 << endl;
+    }
+  }
+  out.close();
+  if(rename(tmpname.c_str(), filename) == -1) {
+    perror("can't write metrics file");
+  }
+}
+
+// Gets system i admitted through the admission semaphore under admission
+// control (see admission_state). Returns true once admitted, or false right
+// away, or as soon as it is dropped from the queue, when it is shed.
+bool admit(int semSet, int i) {
+  struct sembuf sem = make_sem_op(ADMISSION_SEM, -1, SEM_UNDO | IPC_NOWAIT);
+  if(semop(semSet, &sem, 1) == 0) {
+    if(overflow_policy == OVERFLOW_CODEL) codel_update(0, now_ns());
+    __atomic_fetch_add(&admission->admitted, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  uint64_t arrived = now_ns();
+  bool queued = true;
+  if(overflow_policy == OVERFLOW_CODEL && codel_should_shed(arrived)) {
+    queued = false;
+  }
+  else if(__atomic_add_fetch(&admission->waiting, 1, __ATOMIC_RELAXED) > admission_bound) {
+    if(overflow_policy != OVERFLOW_DROP_OLDEST || !drop_oldest_waiter()) {
+      __atomic_sub_fetch(&admission->waiting, 1, __ATOMIC_RELAXED);
+      queued = false;
+    }
+  }
+  if(!queued) {
+    if(debug) cout << "Admission shed system " << i << endl;
+    __atomic_fetch_add(&admission->shed, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  // wait in slices, so that a process dropped from the queue notices it
+  uint64_t ticket = __atomic_add_fetch(&admission->next_ticket, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&admission->tickets[worker_id], ticket, __ATOMIC_RELAXED);
+  struct timespec slice = { 0, ADMISSION_POLL_USEC * 1000 };
+  bool admitted = false;
+  sem.sem_flg = SEM_UNDO;
+  slot_waiting();
+  for(;;) {
+    if(semtimedop(semSet, &sem, 1, &slice) == 0) {
+      admitted = true;
+      break;
+    }
+    if(errno != EAGAIN && errno != EINTR) break;
+    if(__atomic_load_n(&admission->tickets[worker_id], __ATOMIC_RELAXED) == DROPPED_TICKET) break;
+  }
+  slot_running();
+  __atomic_store_n(&admission->tickets[worker_id], 0, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&admission->waiting, 1, __ATOMIC_RELAXED);
+
+  uint64_t now = now_ns();
+  uint64_t waited = now - arrived;
+  record_blocked(i, UNKNOWN_HOLDER, ADMISSION_SEM, waited / 1e9);
+  if(!admitted) {
+    if(debug) cout << "Admission dropped system " << i << " after " << waited / 1e6 << " ms" << endl;
+    __atomic_fetch_add(&admission->shed, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  if(overflow_policy == OVERFLOW_CODEL) codel_update(waited, now);
+  __atomic_fetch_add(&admission->admitted, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&admission->wait_ns, waited, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&admission->max_wait_ns, __ATOMIC_RELAXED);
+  while(waited > max && !__atomic_compare_exchange_n(&admission->max_wait_ns, &max, waited, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return true;
+}
+
+// Drops the process that has been queued for admission the longest, to
+// make room for a newcomer. Returns false if there was nobody to drop.
+bool drop_oldest_waiter() {
+  for(;;) {
+    int oldest = -1;
+    uint64_t oldest_ticket = DROPPED_TICKET;
+    for(int w = 0; w < worker_count; w++) {
+      uint64_t ticket = __atomic_load_n(&admission->tickets[w], __ATOMIC_RELAXED);
+      if(ticket != 0 && ticket < oldest_ticket) {
+        oldest = w;
+        oldest_ticket = ticket;
+      }
+    }
+    if(oldest == -1) return false;
+    if(__atomic_compare_exchange_n(&admission->tickets[oldest], &oldest_ticket, DROPPED_TICKET, false,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return true;
+  }
+}
+
+// CoDel, on arrival: whether a newcomer is to be shed because the queueing
+// delay has been above target for too long (see codel_update)
+bool codel_should_shed(uint64_t now) {
+  bool shed = false;
+  spin_lock(&admission->codel_lock);
+  if(admission->dropping && now >= admission->drop_next_ns) {
+    shed = true;
+    admission->drop_count++;
+    admission->drop_next_ns = now + (uint64_t) (codel_interval_usec * 1000 / sqrt((double) admission->drop_count));
+  }
+  spin_unlock(&admission->codel_lock);
+  return shed;
+}
+
+// CoDel, on admission: tracks how long the queueing delay has stayed above
+// target, and starts shedding once that has lasted a whole interval
+void codel_update(uint64_t waited, uint64_t now) {
+  uint64_t interval = codel_interval_usec * 1000;
+  spin_lock(&admission->codel_lock);
+  if(waited < (uint64_t) codel_target_usec * 1000) {
+    admission->first_above_ns = 0;
+    admission->dropping = false;
+  }
+  else if(admission->first_above_ns == 0) {
+    admission->first_above_ns = now + interval;
+  }
+  else if(!admission->dropping && now >= admission->first_above_ns) {
+    admission->dropping = true;
+    // start again near the last drop rate if it was shedding a moment ago;
+    // the next drop it had planned may still be ahead of now
+    bool recent = now < admission->drop_next_ns || now - admission->drop_next_ns < 16 * interval;
+    admission->drop_count = (recent && admission->drop_count > 2) ? admission->drop_count - 2 : 1;
+    admission->drop_next_ns = now;
+  }
+  spin_unlock(&admission->codel_lock);
+}
+
+// Prints how many transactions admission control admitted and shed, and
+// the queueing delay of the ones it admitted
+void print_admission_report() {
+  const char * policies[] = { "reject", "drop-oldest", "codel" };
+  cout << "Admission (queue " << admission_bound << ", " << policies[overflow_policy] << "): admitted "
+       << admission->admitted << ", shed " << admission->shed << endl;
+  if(admission->admitted > 0) {
+    cout << "  queueing delay mean " << admission->wait_ns / 1e6 / admission->admitted
+         << " ms, max " << admission->max_wait_ns / 1e6 << " ms" << endl;
+  }
+}
+
+// Takes up to n tokens from a count of them, and returns how many it took
+long take_tokens(long * count, long n) {
+  long have = __atomic_load_n(count, __ATOMIC_RELAXED);
+  long take;
+  do {
+    take = have < n ? have : n;
+    if(take <= 0) return 0;
+  } while(!__atomic_compare_exchange_n(count, &have, have - take, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+  return take;
+}
+
+// Gives tokens back to the global budget, waking whoever waits for one
+void return_tokens(long n) {
+  __atomic_fetch_add(&budget->tokens, n, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&budget->waiters, __ATOMIC_SEQ_CST) > 0) {
+    __atomic_fetch_add(&budget->generation, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &budget->generation, FUTEX_WAKE, (int) n, NULL, NULL, 0);
+  }
+}
+
+// Gets system i admitted with a token (see admission_budget): from the pool
+// of this CPU, else with a batch from the global budget, else from any pool,
+// else once one is returned
+void pool_admit(int i) {
+  struct admission_pool * pool = &budget->pools[sched_getcpu() % admission_pools];
+  if(take_tokens(&pool->tokens, 1) == 1) {
+    __atomic_fetch_add(&pool->local, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  long got = take_tokens(&budget->tokens, pool_batch);
+  if(got > 0) {
+    if(got > 1) __atomic_fetch_add(&pool->tokens, got - 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&pool->refills, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // the waiters count is raised before looking at the pools, and a release
+  // into a pool looks at it after, so a token is never left behind in one
+  uint64_t start = now_ns();
+  slot_waiting();
+  __atomic_fetch_add(&budget->waiters, 1, __ATOMIC_SEQ_CST);
+  struct timespec slice = { 0, ADMISSION_POLL_USEC * 1000 };
+  while(true) {
+    uint32_t generation = __atomic_load_n(&budget->generation, __ATOMIC_SEQ_CST);
+    if(take_tokens(&budget->tokens, 1) == 1) break;
+    bool stolen = false;
+    for(int p = 0; p < admission_pools && !stolen; p++) {
+      stolen = take_tokens(&budget->pools[p].tokens, 1) == 1;
+    }
+    if(stolen) {
+      __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    syscall(SYS_futex, &budget->generation, FUTEX_WAIT, generation, &slice, NULL, 0);
+  }
+  __atomic_fetch_sub(&budget->waiters, 1, __ATOMIC_SEQ_CST);
+  slot_running();
+  uint64_t waited = now_ns() - start;
+  __atomic_fetch_add(&pool->waits, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pool->wait_ns, waited, __ATOMIC_RELAXED);
+  record_blocked(i, UNKNOWN_HOLDER, ADMISSION_SEM, waited / 1e9);
+}
+
+// Gives back the admission token of a transaction, to the pool of this CPU
+// unless someone is waiting for one, and rebalances the pool
+void pool_release() {
+  if(__atomic_load_n(&budget->waiters, __ATOMIC_SEQ_CST) > 0) {
+    return_tokens(1);
+    return;
+  }
+  struct admission_pool * pool = &budget->pools[sched_getcpu() % admission_pools];
+  long tokens = __atomic_add_fetch(&pool->tokens, 1, __ATOMIC_SEQ_CST);
+  long extra = 0;
+  if(__atomic_load_n(&budget->waiters, __ATOMIC_SEQ_CST) > 0) {
+    extra = take_tokens(&pool->tokens, ADMISSION_TOKENS); // all of them, for the waiters
+  }
+  else if(tokens > 2 * pool_batch) {
+    extra = take_tokens(&pool->tokens, pool_batch);
+    if(extra > 0) __atomic_fetch_add(&budget->returns, 1, __ATOMIC_RELAXED);
+  }
+  if(extra > 0) return_tokens(extra);
+}
+
+// Releases the admission of a transaction, through its semaphore or its pool
+void leave_admission(int semSet) {
+  if(budget != NULL) pool_release();
+  else release_resource(semSet, ADMISSION_SEM);
+}
+
+// Prints where the admissions through the pools got their tokens
+void print_pool_report() {
+  long local = 0, refills = 0, steals = 0, waits = 0, tokens = budget->tokens;
+  uint64_t wait_ns = 0;
+  for(int p = 0; p < admission_pools; p++) {
+    local += budget->pools[p].local;
+    refills += budget->pools[p].refills;
+    steals += budget->pools[p].steals;
+    waits += budget->pools[p].waits;
+    wait_ns += budget->pools[p].wait_ns;
+    tokens += budget->pools[p].tokens;
+  }
+  long admitted = local + refills + waits;
+  cout << "Admission pools (" << admission_pools << ", batch " << pool_batch << "): admitted " << admitted
+       << ", " << (admitted > 0 ? 100.0 * local / admitted : 0) << "% from the local pool, "
+       << refills << " refills and " << budget->returns << " returns of the global budget" << endl;
+  cout << "  waited " << waits << " times (" << wait_ns / 1e9 << " s), " << steals << " of them ended stealing from another pool" << endl;
+  if(tokens != ADMISSION_TOKENS) {
+    cout << "ERROR: " << tokens << " admission tokens left, not " << ADMISSION_TOKENS << endl;
+  }
+}
+
+// Counts the transaction of this worker in as holding its databases
+void enter_parallel() {
+  spin_lock(&parallel->lock);
+  uint64_t now = now_ns();
+  if(parallel->since_ns != 0) parallel->level_ns[parallel->active] += now - parallel->since_ns;
+  parallel->since_ns = now;
+  if(++parallel->active > parallel->max_active) parallel->max_active = parallel->active;
+  spin_unlock(&parallel->lock);
+  hold_started_ns = now;
+}
+
+// Counts the transaction of system i out as it starts releasing its
+// databases, adding how long it held them to both and to the slot of its worker
+void leave_parallel(int i) {
+  spin_lock(&parallel->lock);
+  uint64_t now = now_ns();
+  uint64_t held = now - hold_started_ns;
+  parallel->level_ns[parallel->active--] += now - parallel->since_ns;
+  parallel->since_ns = now;
+  parallel->txns[i]++;
+  parallel->hold_ns += held;
+  parallel->db_hold_ns[topology[i].db1] += held;
+  parallel->db_hold_ns[topology[i].db2] += held;
+  slot->hold_ns += held;
+  spin_unlock(&parallel->lock);
+}
+
+// The most transactions that can hold their databases at once: the largest
+// set of the systems that ran in which no two share a database, and never
+// more than the admission semaphore lets in
+int max_concurrency() {
+  int best = 0;
+  for(int set = 1; set < 1 << DB_COUNT; set++) {
+    int size = 0;
+    bool independent = true;
+    for(int a = 0; a < DB_COUNT && independent; a++) {
+      if(!(set & 1 << a)) continue;
+      if(parallel->txns[a] == 0) independent = false;
+      for(int b = a + 1; b < DB_COUNT && independent; b++) {
+        if(set & 1 << b && shares_database(a, b)) independent = false;
+      }
+      size++;
+    }
+    if(independent && size > best) best = size;
+  }
+  return best < ADMISSION_TOKENS ? best : ADMISSION_TOKENS;
+}
+
+// Prints how much of the concurrency the conflicts between the systems
+// allow the run achieved. The makespan of the transactions can't be shorter
+// than the time the busiest database was held (its users go one at a time),
+// than the time the busiest worker held databases (its transactions go one
+// after another), or than all the holding time spread over the most
+// transactions that can hold at once. The span the transactions actually
+// took, from the first one holding its databases to the last one letting
+// go, over that bound is how much a better schedule could gain at most.
+void print_parallelism_report(double elapsed) {
+  long txns = 0;
+  for(int system = 0; system < DB_COUNT; system++) txns += parallel->txns[system];
+  if(txns == 0) return;
+  uint64_t span_ns = 0;
+  for(int level = 0; level <= DB_COUNT; level++) span_ns += parallel->level_ns[level];
+  int busiest = 0;
+  for(int db = 1; db < DB_COUNT; db++) if(parallel->db_hold_ns[db] > parallel->db_hold_ns[busiest]) busiest = db;
+  uint64_t worker_ns = 0;
+  for(int w = 0; w < worker_count; w++) if(slots[w].hold_ns > worker_ns) worker_ns = slots[w].hold_ns;
+  int allowed = max_concurrency();
+  double span = span_ns / 1e9;
+  double db_bound = parallel->db_hold_ns[busiest] / 1e9;
+  double worker_bound = worker_ns / 1e9;
+  double work_bound = parallel->hold_ns / 1e9 / allowed;
+  double bound = db_bound > worker_bound ? db_bound : worker_bound;
+  if(work_bound > bound) bound = work_bound;
+
+  cout << "Parallelism: " << txns << " transactions held their databases for " << parallel->hold_ns / 1e9
+       << " s in all, over a span of " << span << " s (of " << elapsed << " s elapsed)" << endl;
+  cout << "  the conflicts between the systems allow " << allowed << " at once, achieved mean "
+       << (span > 0 ? parallel->hold_ns / 1e9 / span : 0) << " and max " << parallel->max_active << endl;
+  cout << "  time with";
+  for(int level = 0; level <= parallel->max_active; level++) cout << (level > 0 ? " / " : " ") << level;
+  cout << " holding:";
+  for(int level = 0; level <= parallel->max_active; level++) {
+    cout << (level > 0 ? "% / " : " ") << (span_ns > 0 ? 100.0 * parallel->level_ns[level] / span_ns : 0);
+  }
+  cout << "%" << endl;
+  cout << "  makespan lower bound " << bound << " s: " << db_filenames[busiest] << " held " << db_bound
+       << " s, busiest worker " << worker_bound << " s, all the holding over " << allowed << " at once " << work_bound << " s" << endl;
+  if(span > 0) {
+    cout << "  efficiency " << 100 * bound / span << "%: a better schedule could finish up to "
+         << span / bound << "x sooner" << endl;
+  }
+}
+
+// Links timer t at the head of a list of the wheel, or unlinks it from
+// its list, with the wheel locked
+void wheel_link(int t, int list) {
+  struct wheel_timer * timer = &wheel->timers[t];
+  timer->list = list;
+  timer->prev = -1;
+  timer->next = wheel->heads[list];
+  if(timer->next != -1) wheel->timers[timer->next].prev = t;
+  wheel->heads[list] = t;
+}
+
+void wheel_unlink(int t) {
+  struct wheel_timer * timer = &wheel->timers[t];
+  if(timer->prev != -1) wheel->timers[timer->prev].next = timer->next;
+  else wheel->heads[timer->list] = timer->next;
+  if(timer->next != -1) wheel->timers[timer->next].prev = timer->prev;
+  timer->list = -1;
+}
+
+// Links timer t into the slot its expiry falls in: on the lowest level
+// whose slots, counted from the current tick, reach that far. A timer due
+// now, as one cascading down can be, goes in the slot about to expire.
+void wheel_place(int t) {
+  uint64_t expires = wheel->timers[t].expires;
+  if(expires < wheel->tick) expires = wheel->tick;
+  uint64_t ahead = expires - wheel->tick;
+  int level = 0;
+  while(level < WHEEL_LEVELS - 1 && ahead >= 1ULL << (WHEEL_BITS * (level + 1))) level++;
+  wheel_link(t, level * WHEEL_SLOTS + ((expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)));
+}
+
+// Arms the timer of this worker to expire usec from now, in place of
+// whatever it was armed for
+void arm_timer(long usec) {
+  uint64_t expires = (now_ns() - wheel->start_ns + usec * 1000ULL) / (TIMER_TICK_USEC * 1000) + 1;
+  spin_lock(&wheel->lock);
+  if(wheel->timers[worker_id].list != -1) wheel_unlink(worker_id);
+  wheel->timers[worker_id].pid = getpid();
+  wheel->timers[worker_id].expires = expires;
+  wheel_place(worker_id);
+  wheel->armed++;
+  spin_unlock(&wheel->lock);
+}
+
+// Disarms the timer of this worker, which stops its wakeups if it expired
+void cancel_timer() {
+  spin_lock(&wheel->lock);
+  int list = wheel->timers[worker_id].list;
+  if(list != -1) wheel_unlink(worker_id);
+  if(list != -1 && list != EXPIRED_LIST) wheel->cancelled++;
+  spin_unlock(&wheel->lock);
+}
+
+bool timer_expired() {
+  return __atomic_load_n(&wheel->timers[worker_id].list, __ATOMIC_ACQUIRE) == EXPIRED_LIST;
+}
+
+// Does one tick of the wheel, with it locked: cascades the timers of the
+// levels that come round to their next slot, then expires the timers of
+// the current slot of the lowest level
+void advance_wheel() {
+  uint64_t tick = ++wheel->tick;
+  for(int level = 1; level < WHEEL_LEVELS; level++) {
+    if(tick & ((1ULL << (WHEEL_BITS * level)) - 1)) break; // the level below has not wrapped around
+    int list = level * WHEEL_SLOTS + ((tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    int t = wheel->heads[list];
+    wheel->heads[list] = -1;
+    while(t != -1) {
+      int next = wheel->timers[t].next;
+      wheel_place(t);
+      t = next;
+    }
+  }
+  int list = tick & (WHEEL_SLOTS - 1);
+  int t = wheel->heads[list];
+  wheel->heads[list] = -1;
+  while(t != -1) {
+    int next = wheel->timers[t].next;
+    wheel_link(t, EXPIRED_LIST);
+    wheel->expired++;
+    t = next;
+  }
+}
+
+// Body of the ticker process: advances the wheel every tick, catching up
+// on the ticks it overslept, and wakes the workers of the expired timers
+// in one batch, outside of the lock
+void run_ticker() {
+  int batch[MAX_WORKERS];
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(!__atomic_load_n(&startup->workers_done, __ATOMIC_ACQUIRE)) {
+    next.tv_nsec += TIMER_TICK_USEC * 1000;
+    if(next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    uint64_t now = (now_ns() - wheel->start_ns) / (TIMER_TICK_USEC * 1000);
+    int count = 0;
+    spin_lock(&wheel->lock);
+    while(wheel->tick < now) {
+      advance_wheel();
+      wheel->ticks++;
+    }
+    for(int t = wheel->heads[EXPIRED_LIST]; t != -1; t = wheel->timers[t].next) batch[count++] = t;
+    if(count > 0) {
+      wheel->batches++;
+      wheel->wakeups += count;
+      if(count > wheel->max_batch) wheel->max_batch = count;
+    }
+    spin_unlock(&wheel->lock);
+    for(int k = 0; k < count; k++) {
+      if(events != NULL) post_event(batch[k]);
+      else kill(wheel->timers[batch[k]].pid, SIGUSR1);
+    }
+  }
+}
+
+// Takes a database semaphore, or gives up once the timer of this worker
+// has expired. Returns whether it got it.
+bool timed_acquire(int semSet, int semid) {
+  struct sembuf sem = make_sem_op(semid, -1);
+  while(logged_semop(semSet, &sem, 1) == -1) {
+    if(errno != EINTR) {
+      perror("semop error");
+      exit(-1);
+    }
+    if(timer_expired()) {
+      __atomic_fetch_add(&wheel->timed_out, 1, __ATOMIC_RELAXED);
+      if(debug) cout << "Gave up on semaphore " << semid << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Waits before the next attempt of a transaction whose acquisition timed
+// out: backoff_usec doubled for every attempt so far, less up to half of
+// it at random so that the workers that gave up together retry apart
+void back_off(int attempt) {
+  static unsigned int seed = getpid();
+  long usec = backoff_usec << (attempt < MAX_BACKOFF_SHIFT ? attempt : MAX_BACKOFF_SHIFT);
+  usec -= rand_r(&seed) % (usec / 2 + 1);
+  uint64_t start = now_ns();
+  arm_timer(usec);
+  while(!timer_expired()) {
+    if(events != NULL) wait_for_events();
+    else pause();
+  }
+  cancel_timer();
+  __atomic_fetch_add(&wheel->backoffs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&wheel->backoff_ns, now_ns() - start, __ATOMIC_RELAXED);
+}
+
+// Prints what the timer wheel did, and how the timed acquisitions went
+void print_wheel_report() {
+  cout << "Timer wheel (" << TIMER_TICK_USEC << " us ticks, " << WHEEL_LEVELS << " levels of " << WHEEL_SLOTS
+       << " slots): " << wheel->armed << " timers armed, " << wheel->cancelled << " cancelled, "
+       << wheel->expired << " expired" << endl;
+  cout << "  " << wheel->ticks << " ticks, " << wheel->wakeups << " wakeups in " << wheel->batches
+       << " batches (at most " << wheel->max_batch << " at once)" << endl;
+  cout << "  " << wheel->timed_out << " acquisitions timed out, " << wheel->backoffs << " back-offs for "
+       << wheel->backoff_ns / 1e9 << " s" << endl;
+}
+
+// Makes the epoll instance of this worker, watching its eventfd
+void open_event_loop() {
+  if((event_loop = epoll_create1(0)) == -1) {
+    perror("epoll_create1 error");
+    exit(-1);
+  }
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = event_fds[worker_id];
+  if(epoll_ctl(event_loop, EPOLL_CTL_ADD, event_fds[worker_id], &ev) == -1) {
+    perror("epoll_ctl error");
+    exit(-1);
+  }
+}
+
+// Wakes worker W up from its event loop
+void post_event(int w) {
+  uint64_t one = 1;
+  // a full counter already wakes it up
+  if(write(event_fds[w], &one, sizeof(one)) == -1 && errno != EAGAIN) perror("eventfd write error");
+}
+
+// Waits in the event loop of this worker until its eventfd is posted,
+// and takes what was posted so that the next wait blocks again
+void wait_for_events() {
+  struct epoll_event ev;
+  if(epoll_wait(event_loop, &ev, 1, -1) == -1 && errno != EINTR) {
+    perror("epoll_wait error");
+    exit(-1);
+  }
+  uint64_t posted;
+  if(read(event_fds[worker_id], &posted, sizeof(posted)) == -1 && errno != EAGAIN) {
+    perror("eventfd read error");
+    exit(-1);
+  }
+  __atomic_fetch_add(&events->wakeups, 1, __ATOMIC_RELAXED);
+}
+
+// Takes semaphore SEM, waiting in the event loop for a grant while it is
+// taken, or when TIMED gives up once the timer of this worker has expired
+// (with --acquire-timeout-usec). Returns whether it got it.
+bool event_acquire(int semSet, int sem_num, bool timed) {
+  struct sembuf sem = make_sem_op(sem_num, -1, SEM_UNDO | IPC_NOWAIT);
+  if(logged_semop(semSet, &sem, 1) == 0) return true;
+
+  struct grant_waiter * self = &events->waiters[worker_id];
+  self->sem = sem_num;
+  self->ticket = __atomic_fetch_add(&events->next_ticket, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&self->state, GRANT_WAITING, __ATOMIC_RELEASE);
+  // either the releaser sees this, or this sees what it released
+  __atomic_fetch_add(&events->waiting[sem_num], 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&events->waits, 1, __ATOMIC_RELAXED);
+
+  bool acquired = true;
+  bool woken = false;
+  while(logged_semop(semSet, &sem, 1) == -1) {
+    if(errno != EAGAIN && errno != EINTR) {
+      perror("semop error");
+      exit(-1);
+    }
+    if(woken) __atomic_fetch_add(&events->retaken, 1, __ATOMIC_RELAXED);
+    if(timed && wheel != NULL && timer_expired()) {
+      __atomic_fetch_add(&wheel->timed_out, 1, __ATOMIC_RELAXED);
+      if(debug) cout << "Gave up on semaphore " << sem_num << endl;
+      acquired = false;
+      break;
+    }
+    wait_for_events();
+    int notified = GRANT_NOTIFIED;
+    woken = __atomic_compare_exchange_n(&self->state, &notified, GRANT_WAITING, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE);
+  }
+
+  __atomic_fetch_sub(&events->waiting[sem_num], 1, __ATOMIC_SEQ_CST);
+  if(__atomic_exchange_n(&self->state, GRANT_IDLE, __ATOMIC_ACQ_REL) == GRANT_NOTIFIED) {
+    // a grant this didn't use goes to the next one waiting
+    __atomic_fetch_add(&events->passed_on, 1, __ATOMIC_RELAXED);
+    notify_waiter(sem_num);
+  }
+  return acquired;
+}
+
+// Hands the grant of semaphore SEM, just released, to the worker that has
+// waited for it the longest, if any does
+void notify_waiter(int sem_num) {
+  while(__atomic_load_n(&events->waiting[sem_num], __ATOMIC_SEQ_CST) > 0) {
+    int oldest = -1;
+    for(int w = 0; w < worker_count; w++) {
+      struct grant_waiter * waiter = &events->waiters[w];
+      if(__atomic_load_n(&waiter->state, __ATOMIC_ACQUIRE) != GRANT_WAITING || waiter->sem != sem_num) continue;
+      if(oldest == -1 || waiter->ticket < events->waiters[oldest].ticket) oldest = w;
+    }
+    // the ones waiting have all been told already
+    if(oldest == -1) return;
+    int waiting = GRANT_WAITING;
+    if(__atomic_compare_exchange_n(&events->waiters[oldest].state, &waiting, GRANT_NOTIFIED, false, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_ACQUIRE)) {
+      __atomic_fetch_add(&events->notified, 1, __ATOMIC_RELAXED);
+      post_event(oldest);
+      return;
+    }
+  }
+}
+
+// Prints how the semaphore grants went through the event loops
+void print_event_report() {
+  cout << "Event grants: " << events->waits << " acquisitions waited, " << events->notified << " grants posted ("
+       << events->passed_on << " passed on), " << events->wakeups << " wakeups, " << events->retaken
+       << " found the semaphore taken again" << endl;
+}
+
+// Shows in the slot of this worker that it is blocked, on a semaphore, a
+// file lock or an admission, until slot_running
+void slot_waiting() {
+  __atomic_store_n(&slot->waits, slot->waits + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->status, SLOT_WAITING, __ATOMIC_RELEASE);
+}
+
+void slot_running() {
+  __atomic_store_n(&slot->status, SLOT_RUNNING, __ATOMIC_RELEASE);
+}
+
+// Body of the watcher (--watch-ms): every watch_ms, adds up the slots of
+// the workers and prints how many are doing what, the transactions done
+// since the last time, and the worker that has been quiet the longest
+void run_watcher() {
+  long last = 0;
+  while(!__atomic_load_n(&startup->workers_done, __ATOMIC_ACQUIRE)) {
+    usleep(watch_ms * 1000);
+    int statuses[SLOT_DONE + 1] = { 0 };
+    long transactions = 0;
+    long waits = 0;
+    int quietest = -1;
+    uint64_t quietest_ns = 0;
+    uint64_t now = now_ns();
+    for(int w = 0; w < worker_count; w++) {
+      int status = __atomic_load_n(&slots[w].status, __ATOMIC_ACQUIRE);
+      statuses[status]++;
+      transactions += __atomic_load_n(&slots[w].transactions, __ATOMIC_RELAXED);
+      waits += __atomic_load_n(&slots[w].waits, __ATOMIC_RELAXED);
+      uint64_t heartbeat = __atomic_load_n(&slots[w].heartbeat_ns, __ATOMIC_RELAXED);
+      if(status == SLOT_DONE || heartbeat == 0) continue;
+      if(quietest == -1 || now - heartbeat > quietest_ns) {
+        quietest = w;
+        quietest_ns = now - heartbeat;
+      }
+    }
+    cout << "Watch: " << transactions << " transactions (" << (transactions - last) * 1000 / watch_ms << "/s), "
+         << waits << " waits; " << statuses[SLOT_STARTING] << " starting, " << statuses[SLOT_RUNNING]
+         << " running, " << statuses[SLOT_WAITING] << " waiting, " << statuses[SLOT_DONE] << " done";
+    if(quietest != -1) {
+      cout << "; quietest worker " << quietest << " (pid: " << slots[quietest].pid << ", "
+           << topology[slots[quietest].system].name << ", transaction " << slots[quietest].txn << ") for "
+           << quietest_ns / 1000000 << " ms";
+    }
+    cout << endl;
+    last = transactions;
+  }
+}
+
+// Sets up the first version of every database: the records its file holds
+long count_records(const char * filename) {
+  ifstream db(filename);
+  string line;
+  long records = 0;
+  while(getline(db, line)) records++;
+  return records;
+}
+
+void init_versions() {
+  memset(store, 0, sizeof(struct mvcc_store));
+  for(int db = 0; db < DB_COUNT; db++) {
+    store->versions[db][0].used = true;
+    store->versions[db][0].records = count_records(db_filenames[db]);
+    store->initial_records += store->versions[db][0].records;
+  }
+}
+
+// Publishes a new version of the two databases of a transaction, which the
+// caller still holds, under the next commit number (see mvcc_store)
+void publish_versions(int db1, int db2, const char * systemName) {
+  uint64_t ts = __atomic_add_fetch(&store->next_ts, 1, __ATOMIC_ACQ_REL);
+  int dbs[2] = { db1, db2 };
+  for(int d = 0; d < 2; d++) {
+    int newest = 0;
+    for(int v = 1; v < MVCC_VERSIONS; v++) {
+      struct db_version * version = &store->versions[dbs[d]][v];
+      if(version->used && version->commit_ts > store->versions[dbs[d]][newest].commit_ts) newest = v;
+    }
+    long records = store->versions[dbs[d]][newest].records + 2;
+
+    struct db_version * version = &store->versions[dbs[d]][pick_version_slot(dbs[d])];
+    __atomic_store_n(&version->seq, version->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    version->commit_ts = ts;
+    version->used = true;
+    version->records = records;
+    snprintf(version->last_record, RECORD_SIZE, "Free from the %s (pid: %d)", systemName, getpid());
+    __atomic_store_n(&version->seq, version->seq + 1, __ATOMIC_RELEASE);
+  }
+  // make the commits visible in order: wait for the previous one to be
+  // published (it is in this same function, so this is short), then this one
+  while(__atomic_load_n(&store->visible_ts, __ATOMIC_ACQUIRE) != ts - 1) sched_yield();
+  __atomic_store_n(&store->visible_ts, ts, __ATOMIC_RELEASE);
+}
+
+// Picks the version of a database to overwrite: an unused one, or else the
+// oldest one, which no snapshot needs once a newer version is old enough
+// for the oldest snapshot being read
+int pick_version_slot(int db) {
+  uint64_t oldest_snapshot = UINT64_MAX;
+  for(int r = 0; r < reader_count; r++) {
+    uint64_t snapshot = __atomic_load_n(&store->snapshots[r], __ATOMIC_ACQUIRE);
+    if(snapshot != 0 && snapshot - 1 < oldest_snapshot) oldest_snapshot = snapshot - 1;
+  }
+  int oldest = 0;
+  int second = -1; // second oldest, the one that replaces the oldest for old snapshots
+  for(int v = 0; v < MVCC_VERSIONS; v++) {
+    struct db_version * version = &store->versions[db][v];
+    if(!version->used) return v;
+    if(version->commit_ts < store->versions[db][oldest].commit_ts) {
+      second = oldest;
+      oldest = v;
+    }
+    else if(v != oldest && (second == -1 || version->commit_ts < store->versions[db][second].commit_ts)) {
+      second = v;
+    }
+  }
+  if(store->versions[db][second].commit_ts > oldest_snapshot) {
+    __atomic_fetch_add(&store->forced_reuse, 1, __ATOMIC_RELAXED);
+  }
+  return oldest;
+}
+
+// Reads the version of a database that snapshot sees into out, without
+// taking any lock. Returns false if that version was reused while reading
+// it, in which case the snapshot has to be retaken.
+bool read_snapshot(int db, uint64_t snapshot, struct db_version * out) {
+  int best = -1;
+  uint64_t seq = 0;
+  for(int v = 0; v < MVCC_VERSIONS; v++) {
+    struct db_version * version = &store->versions[db][v];
+    uint64_t before = __atomic_load_n(&version->seq, __ATOMIC_ACQUIRE);
+    if(before % 2 == 1) continue; // being written, so not part of any snapshot yet
+    if(!version->used || version->commit_ts > snapshot) continue;
+    if(best == -1 || version->commit_ts > out->commit_ts) {
+      memcpy(out, version, sizeof(struct db_version));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(__atomic_load_n(&version->seq, __ATOMIC_RELAXED) != before) return false;
+      best = v;
+      seq = before;
+    }
+  }
+  if(best == -1) return false;
+  // still the same version now that every other one has been looked at
+  return __atomic_load_n(&store->versions[db][best].seq, __ATOMIC_ACQUIRE) == seq;
+}
+
+// Body of a reader process: reads snapshots of all the databases for as
+// long as the workers are running, and checks that each one is consistent.
+// Every committed transaction adds two records to each of its two databases,
+// so the records of snapshot S must number 4 * S more than at startup.
+void run_reader(int r) {
+  struct db_version version;
+  bool last = false;
+  while(!last) {
+    last = __atomic_load_n(&startup->workers_done, __ATOMIC_ACQUIRE);
+    uint64_t snapshot = __atomic_load_n(&store->visible_ts, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&store->snapshots[r], snapshot + 1, __ATOMIC_RELEASE);
+    long records = 0;
+    bool ok = true;
+    for(int db = 0; db < DB_COUNT && ok; db++) {
+      ok = read_snapshot(db, snapshot, &version);
+      records += version.records;
+      if(ok && debug) cout << "Reader " << r << " snapshot " << snapshot << " " << db_filenames[db] << ": "
+                           << version.records << " records, last \"" << version.last_record << "\"" << endl;
+    }
+    __atomic_store_n(&store->snapshots[r], 0, __ATOMIC_RELEASE);
+    if(!ok) {
+      __atomic_fetch_add(&store->retries, 1, __ATOMIC_RELAXED);
+      last = false;
+      continue;
+    }
+    __atomic_fetch_add(&store->reads, 1, __ATOMIC_RELAXED);
+    if(tails != NULL) check_high_water(store->reads % DB_COUNT);
+    if(records != store->initial_records + 4 * (long) snapshot) {
+      __atomic_fetch_add(&store->inconsistent, 1, __ATOMIC_RELAXED);
+    }
+    sched_yield();
+  }
+}
+
+// Prints what the snapshot readers did
+void print_reader_report() {
+  cout << "Snapshot readers: " << reader_count << " readers, " << store->reads << " snapshot reads of all databases, "
+       << store->retries << " retries, " << store->inconsistent << " inconsistent" << endl;
+  cout << "  " << store->visible_ts << " commits published, " << store->forced_reuse
+       << " versions reused under a reader" << endl;
+  if(tails != NULL) {
+    cout << "  " << store->file_reads << " reads of the files up to their high-water mark, "
+         << store->holes << " found a hole" << endl;
+  }
+}
+
+// Seals database db, whose semaphore the caller holds, if its file has
+// grown past seal_bytes (see seal_state)
+void maybe_seal(int db) {
+  if(held_stripe[db] >= 0) return; // the other stripes may be writing to it
+  struct stat st;
+  if(stat(db_filenames[db], &st) == -1 || st.st_size < seal_bytes) return;
+  string sealed = segment_name(db_filenames[db], seal->sealed[db], false);
+  if(rename(db_filenames[db], sealed.c_str()) == -1) {
+    perror("can't seal database");
+    return;
+  }
+  if(debug) cout << "Sealed " << db_filenames[db] << " as " << sealed << endl;
+  __atomic_store_n(&seal->sealed[db], seal->sealed[db] + 1, __ATOMIC_RELEASE);
+}
+
+// Name of segment n of a database, compressed or not
+string segment_name(const char * filename, long n, bool compressed) {
+  char name[256];
+  snprintf(name, sizeof(name), "%s.%ld%s", filename, n, compressed ? ".lz" : "");
+  return name;
+}
+
+// The first segment number of a database that is not taken yet
+long first_free_segment(const char * filename) {
+  struct stat st;
+  long n = 0;
+  while(stat(segment_name(filename, n, false).c_str(), &st) == 0 ||
+        stat(segment_name(filename, n, true).c_str(), &st) == 0) n++;
+  return n;
+}
+
+// Body of the compressor process: compresses the sealed segments as they
+// appear, until the workers are done and every segment has been compressed
+void run_compressor() {
+  for(;;) {
+    bool last = __atomic_load_n(&startup->workers_done, __ATOMIC_ACQUIRE);
+    for(int db = 0; db < DB_COUNT; db++) {
+      long sealed = __atomic_load_n(&seal->sealed[db], __ATOMIC_ACQUIRE);
+      for(long n = seal->compressed[db]; n < sealed; n++) {
+        string raw = segment_name(db_filenames[db], n, false);
+        string lz = segment_name(db_filenames[db], n, true);
+        if(compress_segment(raw.c_str(), lz.c_str())) unlink(raw.c_str());
+        seal->compressed[db] = n + 1;
+      }
+    }
+    if(last) return;
+    usleep(10000);
+  }
+}
+
+// Writes the block compressed version of a sealed segment (see lz_header)
+bool compress_segment(const char * rawname, const char * lzname) {
+  string raw;
+  if(!read_segment(rawname, raw)) return false;
+  string tmpname = string(lzname) + ".tmp";
+  FILE * out = fopen(tmpname.c_str(), "wb");
+  if(out == NULL) {
+    perror("can't write compressed segment");
+    return false;
+  }
+  struct lz_header header = { LZ_MAGIC, LZ_BLOCK_SIZE, (raw.size() + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE, raw.size(), 0 };
+  struct lz_block * index = new lz_block[header.block_count];
+  uint8_t * block = new uint8_t[LZ_BLOCK_SIZE + LZ_BLOCK_SIZE / 255 + 16];
+  uint64_t offset = sizeof(header);
+  fwrite(&header, sizeof(header), 1, out);
+  for(uint64_t b = 0; b < header.block_count; b++) {
+    const uint8_t * src = (const uint8_t *) raw.data() + b * LZ_BLOCK_SIZE;
+    uint32_t len = raw.size() - b * LZ_BLOCK_SIZE < LZ_BLOCK_SIZE ? raw.size() - b * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+    uint32_t size = lz_compress(src, len, block);
+    index[b].offset = offset;
+    index[b].raw_size = len;
+    if(size >= len) {
+      index[b].size = len | LZ_STORED;
+      fwrite(src, 1, len, out);
+      offset += len;
+    }
+    else {
+      index[b].size = size;
+      fwrite(block, 1, size, out);
+      offset += size;
+    }
+  }
+  header.index_offset = offset;
+  fwrite(index, sizeof(struct lz_block), header.block_count, out);
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  bool ok = fclose(out) == 0 && rename(tmpname.c_str(), lzname) == 0;
+  if(debug) cout << "Compressed " << rawname << ": " << raw.size() << " to " << offset << " bytes" << endl;
+  delete[] index;
+  delete[] block;
+  return ok;
+}
+
+// Block compressor: emits LZ4 style sequences (a token with the literal and
+// match lengths, the literals, a 2 byte offset) for the matches found through
+// a hash table of the last position of every 4 byte string. dst must hold
+// len + len / 255 + 16 bytes. Returns the compressed size.
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+static inline uint32_t read32(const uint8_t * p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint8_t * lz_length(uint8_t * op, size_t len) {
+  while(len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+size_t lz_compress(const uint8_t * src, size_t len, uint8_t * dst) {
+  uint32_t table[1 << LZ_HASH_BITS] = { 0 };
+  const uint8_t * ip = src;
+  const uint8_t * anchor = src;
+  const uint8_t * end = src + len;
+  uint8_t * op = dst;
+  // as in LZ4, the last match starts 12 bytes before the end at the latest,
+  // and the last 5 bytes are always literals
+  if(len > 12) {
+    const uint8_t * match_start_limit = end - 12;
+    const uint8_t * match_end_limit = end - 5;
+    unsigned misses = 0;
+    while(ip < match_start_limit) {
+      uint32_t seq = read32(ip);
+      uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+      const uint8_t * ref = src + table[hash];
+      table[hash] = ip - src;
+      if(ref >= ip || ip - ref > 65535 || read32(ref) != seq) {
+        ip += 1 + (misses++ >> 5); // skip faster through what does not compress
+        continue;
+      }
+      misses = 0;
+      const uint8_t * match_end = ip + LZ_MIN_MATCH;
+      ref += LZ_MIN_MATCH;
+      while(match_end < match_end_limit && *match_end == *ref) {
+        match_end++;
+        ref++;
+      }
+      size_t literals = ip - anchor;
+      size_t match = match_end - ip - LZ_MIN_MATCH;
+      uint8_t * token = op++;
+      *token = (literals < 15 ? literals : 15) << 4 | (match < 15 ? match : 15);
+      if(literals >= 15) op = lz_length(op, literals - 15);
+      memcpy(op, anchor, literals);
+      op += literals;
+      size_t offset = match_end - ref;
+      *op++ = offset & 255;
+      *op++ = offset >> 8;
+      if(match >= 15) op = lz_length(op, match - 15);
+      ip = anchor = match_end;
+    }
+  }
+  // the last literals
+  size_t literals = end - anchor;
+  *op++ = (literals < 15 ? literals : 15) << 4;
+  if(literals >= 15) op = lz_length(op, literals - 15);
+  memcpy(op, anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+// Decompresses a block made by lz_compress into dst, which holds cap bytes.
+// Returns the decompressed size, or -1 if the block is corrupt.
+long lz_decompress(const uint8_t * src, size_t len, uint8_t * dst, size_t cap) {
+  const uint8_t * ip = src;
+  const uint8_t * ip_end = src + len;
+  uint8_t * op = dst;
+  uint8_t * op_end = dst + cap;
+  while(ip < ip_end) {
+    unsigned token = *ip++;
+    size_t literals = token >> 4;
+    if(literals == 15) {
+      unsigned byte;
+      do {
+        if(ip >= ip_end) return -1;
+        byte = *ip++;
+        literals += byte;
+      } while(byte == 255);
+    }
+    if(literals > (size_t) (ip_end - ip) || literals > (size_t) (op_end - op)) return -1;
+    memcpy(op, ip, literals);
+    op += literals;
+    ip += literals;
+    if(ip == ip_end) break; // the last sequence has no match
+
+    if(ip_end - ip < 2) return -1;
+    size_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    size_t match = token & 15;
+    if(match == 15) {
+      unsigned byte;
+      do {
+        if(ip >= ip_end) return -1;
+        byte = *ip++;
+        match += byte;
+      } while(byte == 255);
+    }
+    match += LZ_MIN_MATCH;
+    if(offset == 0 || offset > (size_t) (op - dst) || match > (size_t) (op_end - op)) return -1;
+    const uint8_t * ref = op - offset;
+    if(offset >= match) {
+      memcpy(op, ref, match);
+    }
+    else {
+      // the match overlaps what it produces: copy it one period at a time
+      for(size_t done = 0; done < match; done += offset) {
+        memcpy(op + done, ref + done, match - done < offset ? match - done : offset);
+      }
+    }
+    op += match;
+  }
+  return op - dst;
+}
+
+// Reads a whole segment into out, decompressing it if it is compressed
+bool read_segment(const char * filename, string & out) {
+  size_t len = strlen(filename);
+  if(len > 3 && strcmp(filename + len - 3, ".lz") == 0) return read_lz_range(filename, 0, UINT64_MAX, out);
+  ifstream in(filename, ifstream::binary);
+  if(!in) return false;
+  out.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  return true;
+}
+
+// Reads length bytes from offset of a compressed segment into out, through
+// its index, decompressing only the blocks that the range spans
+bool read_lz_range(const char * filename, uint64_t offset, uint64_t length, string & out) {
+  FILE * in = fopen(filename, "rb");
+  if(in == NULL) return false;
+  struct lz_header header;
+  bool ok = fread(&header, sizeof(header), 1, in) == 1 && header.magic == LZ_MAGIC;
+  out.clear();
+  if(!ok || offset >= header.raw_size) {
+    fclose(in);
+    return ok;
+  }
+  if(length > header.raw_size - offset) length = header.raw_size - offset;
+  uint64_t first = offset / header.block_size;
+  uint64_t last = (offset + length - 1) / header.block_size;
+  struct lz_block * index = new lz_block[last - first + 1];
+  fseek(in, header.index_offset + first * sizeof(struct lz_block), SEEK_SET);
+  ok = fread(index, sizeof(struct lz_block), last - first + 1, in) == last - first + 1;
+  uint8_t * packed = new uint8_t[header.block_size + header.block_size / 255 + 16];
+  uint8_t * block = new uint8_t[header.block_size];
+  for(uint64_t b = first; ok && b <= last; b++) {
+    struct lz_block * entry = &index[b - first];
+    uint32_t size = entry->size & ~LZ_STORED;
+    fseek(in, entry->offset, SEEK_SET);
+    ok = size <= header.block_size + header.block_size / 255 + 16 && fread(packed, 1, size, in) == size;
+    if(!ok) break;
+    const uint8_t * data = packed;
+    if(!(entry->size & LZ_STORED)) {
+      ok = lz_decompress(packed, size, block, header.block_size) == entry->raw_size;
+      data = block;
+    }
+    uint64_t block_start = b * header.block_size;
+    uint64_t from = offset > block_start ? offset - block_start : 0;
+    uint64_t to = offset + length - block_start < entry->raw_size ? offset + length - block_start : entry->raw_size;
+    if(ok) out.append((const char *) data + from, to - from);
+  }
+  delete[] index;
+  delete[] packed;
+  delete[] block;
+  fclose(in);
+  return ok;
+}
+
+// Prints length bytes from offset of a database (see read_database)
+bool cat_segments(const char * filename, uint64_t offset, uint64_t length) {
+  string data;
+  if(!read_database(filename, offset, length, data)) return false;
+  cout << data;
+  return true;
+}
+
+// Reads length bytes from offset of a database into out, as if all its
+// segments (compressed or not) and its open file were one file
+bool read_database(const char * filename, uint64_t offset, uint64_t length, string & out) {
+  out.clear();
+  struct stat st;
+  uint64_t position = 0; // where the current segment starts in the database
+  for(long n = 0; length > 0; n++) {
+    string lz = segment_name(filename, n, true);
+    string raw = segment_name(filename, n, false);
+    string name = stat(lz.c_str(), &st) == 0 ? lz : raw;
+    bool last = stat(name.c_str(), &st) != 0;
+    if(last) name = filename; // past the sealed segments: the open file
+    uint64_t size = st.st_size;
+    if(name == lz) {
+      struct lz_header header;
+      FILE * in = fopen(lz.c_str(), "rb");
+      if(in == NULL || fread(&header, sizeof(header), 1, in) != 1) return false;
+      fclose(in);
+      size = header.raw_size;
+    }
+    else if(last && stat(filename, &st) == 0) {
+      size = st.st_size;
+    }
+    else if(last) {
+      return true;
+    }
+
+    if(offset < position + size) {
+      string data;
+      uint64_t from = offset > position ? offset - position : 0;
+      uint64_t count = length < size - from ? length : size - from;
+      if(name == lz) {
+        if(!read_lz_range(lz.c_str(), from, count, data)) return false;
+      }
+      else {
+        if(!read_segment(name.c_str(), data)) return false;
+        data = data.substr(from, count);
+      }
+      out += data;
+      length -= data.size();
+    }
+    position += size;
+    if(last) break;
+  }
+  return true;
+}
+
+// Compresses a file block by block in memory, then decompresses it over and
+// over for about a second, and prints the ratio and the speeds
+bool run_lz_bench(const char * filename) {
+  string raw;
+  if(!read_segment(filename, raw) || raw.empty()) {
+    cout << "Can't read " << filename << endl;
+    return false;
+  }
+  size_t blocks = (raw.size() + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE;
+  size_t bound = LZ_BLOCK_SIZE + LZ_BLOCK_SIZE / 255 + 16;
+  uint8_t * packed = new uint8_t[blocks * bound];
+  size_t * sizes = new size_t[blocks];
+  uint8_t * block = new uint8_t[LZ_BLOCK_SIZE];
+  size_t total = 0;
+  double start = now_seconds();
+  for(size_t b = 0; b < blocks; b++) {
+    size_t len = raw.size() - b * LZ_BLOCK_SIZE < LZ_BLOCK_SIZE ? raw.size() - b * LZ_BLOCK_SIZE : LZ_BLOCK_SIZE;
+    sizes[b] = lz_compress((const uint8_t *) raw.data() + b * LZ_BLOCK_SIZE, len, packed + b * bound);
+    total += sizes[b];
+  }
+  double compress_time = now_seconds() - start;
+
+  bool ok = true;
+  long rounds = 0;
+  start = now_seconds();
+  do {
+    for(size_t b = 0; b < blocks && ok; b++) {
+      long len = lz_decompress(packed + b * bound, sizes[b], block, LZ_BLOCK_SIZE);
+      ok = len >= 0 && memcmp(block, raw.data() + b * LZ_BLOCK_SIZE, len) == 0;
+    }
+    rounds++;
+  } while(ok && now_seconds() - start < 1);
+  double decompress_time = now_seconds() - start;
+
+  cout << filename << ": " << raw.size() << " bytes to " << total << " (" << 100.0 * total / raw.size() << "%)" << endl;
+  cout << "  compress " << raw.size() / compress_time / 1e9 << " GB/s, decompress "
+       << rounds * raw.size() / decompress_time / 1e9 << " GB/s" << (ok ? "" : ", ROUND TRIP FAILED") << endl;
+  delete[] packed;
+  delete[] sizes;
+  delete[] block;
+  return ok;
+}
+
+// Fills ops with the operations that lock (op -1) or unlock (op 1)
+// database db, whole (stripe -1) or one of its stripes (see split_state).
+// Returns how many there are.
+int db_lock_ops(int db, int stripe, int op, int flags, struct sembuf * ops) {
+  if(split == NULL) {
+    ops[0] = make_sem_op(db, op, flags);
+    return 1;
+  }
+  if(stripe < 0) {
+    ops[0] = make_sem_op(db, op * DB_STRIPES, flags);
+    return 1;
+  }
+  ops[0] = make_sem_op(db, op, flags);
+  ops[1] = make_sem_op(STRIPE_SEM(db, stripe), op, flags);
+  return 2;
+}
+
+// Acquires database db for system i like acquire_tracked, whole or the
+// stripe of the system depending on the mode of the database at the time,
+// then decides on its mode at the end of a window (see split_state)
+void acquire_split(int semSet, int ** shm_ary, int db, int i) {
+  int stripe = __atomic_load_n(&split->striped[db], __ATOMIC_ACQUIRE) ? i % DB_STRIPES : -1;
+  struct sembuf ops[2];
+  int n = db_lock_ops(db, stripe, -1, SEM_UNDO | IPC_NOWAIT, ops);
+  bool waited = logged_semop(semSet, ops, n) == -1;
+  if(waited) {
+    int holder = *shm_ary[db] - 1; // striped locks have no single holder
+    double start = now_seconds();
+    n = db_lock_ops(db, stripe, -1, SEM_UNDO, ops);
+    slot_waiting();
+    logged_semop(semSet, ops, n);
+    slot_running();
+    record_blocked(i, holder >= 0 ? holder : UNKNOWN_HOLDER, db, now_seconds() - start);
+  }
+  held_stripe[db] = stripe;
+
+  __atomic_fetch_add(&split->acquires[db], 1, __ATOMIC_RELAXED);
+  if(stripe >= 0) __atomic_fetch_add(&split->striped_acquires[db], 1, __ATOMIC_RELAXED);
+  if(waited) __atomic_fetch_add(&split->window_waits[db], 1, __ATOMIC_RELAXED);
+  if(__atomic_add_fetch(&split->window_acquires[db], 1, __ATOMIC_ACQ_REL) != SPLIT_WINDOW) return;
+  long waits = __atomic_exchange_n(&split->window_waits[db], 0, __ATOMIC_ACQ_REL);
+  uint64_t now = now_ns();
+  uint64_t window_ns = now - split->window_start_ns[db];
+  split->window_start_ns[db] = now;
+  // acquisitions made since the window filled up count in the next one
+  __atomic_fetch_sub(&split->window_acquires[db], SPLIT_WINDOW, __ATOMIC_ACQ_REL);
+  bool striped = split->striped[db];
+  if(!striped && waits * 100 >= (long) split_hot * SPLIT_WINDOW) {
+    if(debug) cout << "Splitting the lock of " << db_filenames[db] << " into " << DB_STRIPES << " stripes" << endl;
+    split->split_window_ns[db] = window_ns;
+    split->calm_windows[db] = 0;
+    __atomic_store_n(&split->striped[db], true, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&split->splits[db], 1, __ATOMIC_RELAXED);
+  }
+  else if(striped && window_ns < 2 * split->split_window_ns[db]) {
+    split->calm_windows[db] = 0;
+  }
+  else if(striped && ++split->calm_windows[db] == SPLIT_MERGE_WINDOWS) {
+    if(debug) cout << "Merging the stripes of " << db_filenames[db] << " back into one lock" << endl;
+    __atomic_store_n(&split->striped[db], false, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&split->merges[db], 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Releases database db the way this worker locked it
+void release_database(int semSet, int db) {
+  if(partitions != NULL) {
+    int p = held_partition[db];
+    held_partition[db] = -1;
+    partitions->owner[db][p] = 0;
+    struct sembuf sem = make_sem_op(PARTITION_SEM(db, p), 1);
+    logged_semop(semSet, &sem, 1);
+    return;
+  }
+  if(lock_backend != LOCKS_SYSV) {
+    release_file_lock(db);
+    return;
+  }
+  if(split == NULL) {
+    release_resource(semSet, db);
+    return;
+  }
+  struct sembuf ops[2];
+  int n = db_lock_ops(db, held_stripe[db], 1, SEM_UNDO, ops);
+  logged_semop(semSet, ops, n);
+  held_stripe[db] = -1;
+}
+
+// Reserves len bytes at the tail of database db (see file_tail). Returns
+// where they start, and the ticket of the reservation in ticket.
+uint64_t reserve_tail(int db, size_t len, uint64_t * ticket) {
+  struct file_tail * tail = &tails[db];
+  spin_lock(&tail->lock); // striped locks may reserve at the same time
+  uint64_t offset = tail->reserved;
+  tail->reserved += len;
+  *ticket = tail->next_ticket++;
+  spin_unlock(&tail->lock);
+  return offset;
+}
+
+// Writes staged records into their reservation in database db
+void write_staged(int db, const char * records, size_t len, uint64_t offset) {
+  if(staged_fds[db] == -1) {
+    // not O_APPEND: pwrite would append, and ignore the offset
+    staged_fds[db] = open(db_filenames[db], O_WRONLY | O_CREAT, SHM_MODE);
+  }
+  throttle_write(db, len);
+  if(pwrite(staged_fds[db], records, len, offset) != (ssize_t) len) {
+    perror("pwrite error");
+  }
+}
+
+// Moves the high-water mark of database db to end once every reservation
+// before the one with this ticket has been written
+void publish_staged(int db, uint64_t ticket, uint64_t end) {
+  struct file_tail * tail = &tails[db];
+  while(__atomic_load_n(&tail->done_ticket, __ATOMIC_ACQUIRE) != ticket) sched_yield();
+  __atomic_store_n(&tail->high_water, end, __ATOMIC_RELEASE);
+  __atomic_store_n(&tail->done_ticket, ticket + 1, __ATOMIC_RELEASE);
+}
+
+// Reads the last record before the high-water mark of database db, as a
+// reader would, and counts it when it finds a hole (which it should not)
+void check_high_water(int db) {
+  uint64_t high_water = __atomic_load_n(&tails[db].high_water, __ATOMIC_ACQUIRE);
+  if(high_water == 0) return;
+  char buf[RECORD_SIZE];
+  size_t len = high_water < sizeof(buf) ? high_water : sizeof(buf);
+  int fd = open(db_filenames[db], O_RDONLY);
+  if(fd == -1) return;
+  bool hole = pread(fd, buf, len, high_water - len) != (ssize_t) len || buf[len - 1] != '\n' || memchr(buf, '\0', len) != NULL;
+  close(fd);
+  __atomic_fetch_add(&store->file_reads, 1, __ATOMIC_RELAXED);
+  if(hole) __atomic_fetch_add(&store->holes, 1, __ATOMIC_RELAXED);
+}
+
+// Maps a batch file (see batch_record) for the workers to ingest
+bool map_batch(const char * filename) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) return false;
+  batch_size = st.st_size;
+  batch_map = (const char *) mmap(NULL, batch_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(batch_map == MAP_FAILED) return false;
+  madvise((void *) batch_map, batch_size, MADV_SEQUENTIAL);
+  batch_binary = batch_size >= BATCH_MAGIC_LEN && memcmp(batch_map, BATCH_MAGIC, BATCH_MAGIC_LEN) == 0;
+  batch_start = batch_binary ? BATCH_MAGIC_LEN : 0;
+  return true;
+}
+
+// Writes a batch of count transactions for systems k % DB_COUNT, with the
+// default hold time
+bool write_batch(const char * filename, long count) {
+  size_t len = strlen(filename);
+  bool binary = len > 4 && strcmp(filename + len - 4, ".bin") == 0;
+  FILE * out = fopen(filename, "wb");
+  if(out == NULL) {
+    perror("can't write batch");
+    return false;
+  }
+  if(binary) fwrite(BATCH_MAGIC, 1, BATCH_MAGIC_LEN, out);
+  for(long k = 0; k < count; k++) {
+    if(binary) {
+      struct batch_record record = { 0, -1, (int32_t) (k % DB_COUNT) };
+      fwrite(&record, sizeof(record), 1, out);
+    }
+    else {
+      fprintf(out, "0 -1 %ld\n", k % DB_COUNT);
+    }
+  }
+  bool ok = fclose(out) == 0;
+  if(ok) cout << "Wrote " << count << " transactions to " << filename << (binary ? " (binary)" : " (text)") << endl;
+  return ok;
+}
+
+// Body of a worker ingesting a batch: claims chunks until there are none
+// left, and runs their transactions INGEST_BATCH at a time as they are parsed
+void ingest_batch(int semSet, int ** shm_ary, struct worker_slot * slot) {
+  struct trace_entry parsed[INGEST_BATCH];
+  long page = sysconf(_SC_PAGESIZE);
+  for(;;) {
+    uint64_t chunk = __atomic_fetch_add(&ingest->next_chunk, 1, __ATOMIC_RELAXED);
+    uint64_t begin = batch_start + chunk * INGEST_CHUNK;
+    if(begin >= batch_size) return;
+    uint64_t end = begin + INGEST_CHUNK < batch_size ? begin + INGEST_CHUNK : batch_size;
+    uint64_t pos = begin;
+    // a text chunk starts with the first line that starts in it
+    if(!batch_binary && begin > 0 && batch_map[begin - 1] != '\n') {
+      while(pos < batch_size && batch_map[pos] != '\n') pos++;
+      pos++;
+    }
+    while(pos < end) {
+      uint64_t start = now_ns();
+      int count = parse_chunk(pos, &pos, end, parsed, INGEST_BATCH);
+      __atomic_fetch_add(&ingest->parse_ns, now_ns() - start, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&ingest->parsed, count, __ATOMIC_RELAXED);
+      for(int k = 0; k < count; k++) {
+        txn_hold_usec = parsed[k].hold_usec;
+        if(run_transaction(semSet, shm_ary, parsed[k].system) == 0) {
+          __atomic_store_n(&slot->transactions, slot->transactions + 1, __ATOMIC_RELAXED);
+        }
+      }
+    }
+    // done with the chunk: drop its pages, so that memory stays flat
+    uint64_t first_page = (begin + page - 1) / page * page;
+    uint64_t last_page = end / page * page;
+    if(last_page > first_page) madvise((void *) (batch_map + first_page), last_page - first_page, MADV_DONTNEED);
+  }
+}
+
+// Parses up to max transactions of the batch from pos (up to end for
+// records, or lines, that start before it) into out. Returns how many,
+// and where the next one starts in next.
+int parse_chunk(uint64_t pos, uint64_t * next, uint64_t end, struct trace_entry * out, int max) {
+  int count = 0;
+  if(batch_binary) {
+    while(count < max && pos + sizeof(struct batch_record) <= end) {
+      struct batch_record record;
+      memcpy(&record, batch_map + pos, sizeof(record));
+      pos += sizeof(record);
+      if(record.system < 0 || record.system >= DB_COUNT) {
+        __atomic_fetch_add(&ingest->bad, 1, __ATOMIC_RELAXED);
+        continue;
+      }
+      out[count].arrival_usec = record.arrival_usec;
+      out[count].hold_usec = record.hold_usec;
+      out[count++].system = record.system;
+    }
+    *next = pos + sizeof(struct batch_record) > end ? end : pos;
+    return count;
+  }
+
+  // text: "arrival_usec hold_usec system" lines, parsed by hand as the
+  // mapping has no terminating NUL
+  while(count < max && pos < end) {
+    long fields[3] = { 0, 0, 0 };
+    int field = 0;
+    bool negative = false;
+    bool digits = false;
+    bool comment = batch_map[pos] == '#';
+    for(; pos < batch_size && batch_map[pos] != '\n'; pos++) {
+      char c = batch_map[pos];
+      if(comment || field == 3) continue;
+      if(c >= '0' && c <= '9') {
+        fields[field] = fields[field] * 10 + (c - '0');
+        digits = true;
+      }
+      else if(c == '-' && !digits) {
+        negative = true;
+      }
+      else if(digits) {
+        if(negative) fields[field] = -fields[field];
+        field++;
+        negative = digits = false;
+      }
+    }
+    if(digits && field < 3) {
+      if(negative) fields[field] = -fields[field];
+      field++;
+    }
+    pos++; // past the newline
+    if(comment || (field == 0 && !digits)) continue;
+    if(field != 3 || fields[2] < 0 || fields[2] >= DB_COUNT) {
+      __atomic_fetch_add(&ingest->bad, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    out[count].arrival_usec = fields[0];
+    out[count].hold_usec = fields[1];
+    out[count++].system = fields[2];
+  }
+  *next = pos;
+  return count;
+}
+
+// Prints how much was ingested, and what parsing it cost the workers
+void print_ingest_report(double elapsed) {
+  double parse = ingest->parse_ns / 1e9;
+  cout << "Ingested " << ingest->parsed << " transactions from " << ingest_file << " ("
+       << (batch_binary ? "binary" : "text") << ", " << batch_size / 1e6 << " MB) in "
+       << (batch_size - batch_start + INGEST_CHUNK - 1) / INGEST_CHUNK << " chunks, " << ingest->bad << " bad" << endl;
+  cout << "  parsing took " << parse << " s of worker time (" << (elapsed > 0 ? 100 * parse / (elapsed * worker_count) : 0)
+       << "% of it), " << (parse > 0 ? ingest->parsed / parse / 1e6 : 0) << " M transactions/s per worker" << endl;
+}
+
+// Locks database db for system i with a file lock (see lock_backend), like
+// acquire_tracked does with its semaphore
+void acquire_file_lock(int ** shm_ary, int db, int i) {
+  int fd = open(db_filenames[db], O_RDWR | O_CREAT, SHM_MODE);
+  if(fd == -1) {
+    perror("can't open database to lock it");
+    exit(-1);
+  }
+  struct flock lock = {};
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = lock_backend == LOCKS_OFD_RECORD ? OFD_KEY_BASE + i : 0;
+  lock.l_len = lock_backend == LOCKS_OFD_RECORD ? 1 : 0; // 0 = up to the end, whatever it becomes
+  if(fcntl(fd, F_OFD_SETLK, &lock) == -1) {
+    int holder = *shm_ary[db] - 1;
+    double start = now_seconds();
+    slot_waiting();
+    while(fcntl(fd, F_OFD_SETLKW, &lock) == -1) {
+      if(errno != EINTR) {
+        perror("can't lock database");
+        exit(-1);
+      }
+    }
+    slot_running();
+    record_blocked(i, holder >= 0 ? holder : UNKNOWN_HOLDER, db, now_seconds() - start);
+  }
+  lock_fds[db] = fd;
+}
+
+// Unlocks database db, locked by acquire_file_lock: the whole file, which
+// covers the record key too
+void release_file_lock(int db) {
+  struct flock lock = {};
+  lock.l_type = F_UNLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+  fcntl(lock_fds[db], F_OFD_SETLK, &lock);
+  close(lock_fds[db]);
+  lock_fds[db] = -1;
+}
+
+// Prints how much of the time each database was split, and how often
+void print_split_report() {
+  cout << "Lock splitting (at " << split_hot << "% of acquisitions waiting):" << endl;
+  for(int db = 0; db < DB_COUNT; db++) {
+    long acquires = split->acquires[db];
+    cout << "  " << db_filenames[db] << ": " << acquires << " acquisitions, "
+         << (acquires > 0 ? 100.0 * split->striped_acquires[db] / acquires : 0) << "% striped, "
+         << split->splits[db] << " splits, " << split->merges[db] << " merges"
+         << (split->striped[db] ? " (striped at the end)" : "") << endl;
+  }
+}
+
+// Runs a semop through which a worker acquires or releases semaphores,
+// logging it or waiting for its turn to make it (see grant_log)
+int logged_semop(int semSet, struct sembuf * ops, int n) {
+  if(grants == NULL || worker_id < 0) return semop(semSet, ops, n);
+  uint64_t sems = 0;
+  for(int k = 0; k < n; k++) sems |= 1ULL << ops[k].sem_num;
+  int release = ops[0].sem_op > 0;
+
+  if(record_file != NULL) {
+    if(release) log_grant(release, sems);
+    int result = semop(semSet, ops, n);
+    if(!release && result == 0) log_grant(release, sems);
+    return result;
+  }
+
+  if(__atomic_load_n(&grants->abandoned, __ATOMIC_ACQUIRE)) return semop(semSet, ops, n);
+  long e = next_replay_event();
+  if(e == -1 || replay_events[e].release != release || replay_events[e].sems != sems) {
+    if(ops[0].sem_flg & IPC_NOWAIT) {
+      errno = EAGAIN; // this attempt did not get through when recorded either
+      return -1;
+    }
+    abandon_replay(e == -1 ? replay_count : e);
+    return semop(semSet, ops, n);
+  }
+  if(!wait_for_turn(e)) return semop(semSet, ops, n);
+  int result = semop(semSet, ops, n);
+  if(result == -1) {
+    abandon_replay(e);
+    return result;
+  }
+  replay_cursor = e + 1;
+  __atomic_store_n(&grants->next_seq, e + 1, __ATOMIC_RELEASE);
+  return result;
+}
+
+// Logs a grant or release of this worker under the next sequence number
+void log_grant(int release, uint64_t sems) {
+  uint64_t seq = __atomic_fetch_add(&grants->next_seq, 1, __ATOMIC_ACQ_REL);
+  if(seq >= grants->capacity) return; // full: the rest is not kept
+  logged_grants[seq].worker = worker_id;
+  logged_grants[seq].release = release;
+  logged_grants[seq].sems = sems;
+}
+
+// The sequence number of this worker's next grant in the replay, or -1
+// when it has made them all
+long next_replay_event() {
+  while(replay_cursor < replay_count && replay_events[replay_cursor].worker != worker_id) replay_cursor++;
+  return replay_cursor < replay_count ? replay_cursor : -1;
+}
+
+// Waits until it is the turn of grant seq in the replay. Returns false when
+// the replay was abandoned instead, or has been stuck for too long: longer
+// than a transaction holds its databases, with some margin.
+bool wait_for_turn(uint64_t seq) {
+  uint64_t stall_ns = 1000000000ULL + 4 * work_usec * 1000;
+  uint64_t seen = UINT64_MAX;
+  uint64_t since = now_ns();
+  for(int spins = 0; ; spins++) {
+    uint64_t turn = __atomic_load_n(&grants->next_seq, __ATOMIC_ACQUIRE);
+    if(turn == seq) return true;
+    if(__atomic_load_n(&grants->abandoned, __ATOMIC_ACQUIRE)) return false;
+    if(turn != seen) {
+      seen = turn;
+      since = now_ns();
+    }
+    else if(now_ns() - since > stall_ns) {
+      abandon_replay(turn);
+      return false;
+    }
+    if(spins < 100) sched_yield();
+    else usleep(50);
+  }
+}
+
+// Gives up on the replay: the schedule diverged from the log at grant seq
+void abandon_replay(uint64_t seq) {
+  bool was = false;
+  if(__atomic_compare_exchange_n(&grants->abandoned, &was, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    grants->abandoned_at = seq;
+    if(debug) cout << "Replay diverged from the log at grant " << seq << endl;
+  }
+}
+
+// Reads a log made with --record into replay_events
+bool load_grant_log(const char * filename) {
+  ifstream in(filename);
+  if(!in) return false;
+  string line;
+  uint64_t capacity = 0;
+  while(getline(in, line)) {
+    uint64_t seq;
+    int worker;
+    char kind[16];
+    char sems[64];
+    if(line.empty() || line[0] == '#') continue;
+    if(sscanf(line.c_str(), "%" SCNu64 " %d %15s %63s", &seq, &worker, kind, sems) != 4 || seq != replay_count) {
+      cout << "Bad line in " << filename << ": " << line << endl;
+      return false;
+    }
+    if(replay_count == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      replay_events = (struct grant_event *) realloc(replay_events, sizeof(struct grant_event) * capacity);
+    }
+    struct grant_event * e = &replay_events[replay_count++];
+    e->worker = worker;
+    e->release = strcmp(kind, "release") == 0;
+    e->sems = 0;
+    for(char * sem = strtok(sems, ","); sem != NULL; sem = strtok(NULL, ",")) e->sems |= 1ULL << atoi(sem);
+  }
+  return replay_count > 0;
+}
+
+// Writes the grants logged by the workers to a file, in grant order
+void write_grant_log(const char * filename) {
+  uint64_t count = grants->next_seq < grants->capacity ? grants->next_seq : grants->capacity;
+  ofstream out(filename);
+  out << "# sequence worker acquire|release semaphores" << endl;
+  for(uint64_t seq = 0; seq < count; seq++) {
+    struct grant_event * e = &logged_grants[seq];
+    out << seq << " " << e->worker << " " << (e->release ? "release" : "acquire") << " ";
+    const char * separator = "";
+    for(int sem = 0; sem < 64; sem++) {
+      if(e->sems & (1ULL << sem)) {
+        out << separator << sem;
+        separator = ",";
+      }
+    }
+    out << endl;
+  }
+  out.close();
+  cout << "Recorded " << count << " grants to " << filename;
+  if(count < grants->next_seq) cout << " (the log was full, " << grants->next_seq - count << " more were not kept)";
+  cout << endl;
+}
+
+// Prints whether the replay followed the log to the end
+void print_replay_report() {
+  if(grants->abandoned) {
+    cout << "Replay diverged from " << replay_file << " at grant " << grants->abandoned_at << " of "
+         << replay_count << ", the rest ran in no particular order" << endl;
+  }
+  else {
+    cout << "Replayed " << grants->next_seq << " of " << replay_count << " grants in the recorded order" << endl;
+  }
+}
+
+// How many transactions pool mode queues
+long queued_count() {
+  return trace != NULL ? trace_count : (long) worker_count * txn_count;
+}
+
+// Reconstructs the transactions recorded in the database files into a
+// trace (see trace_entry). A transaction is known by its pid, its system,
+// and how many transactions of that system the pid had run before it, which
+// matches its "Being used by" records in its two databases. Each file gives
+// the order of the transactions that used it, and the trace has them in an
+// order that agrees with all the files.
+bool make_trace(const char * filename) {
+  map<pair<long, long>, long> ids; // (pid * DB_COUNT + system, run) -> transaction
+  vector<int> systems; // of each transaction
+  vector<vector<long> > after; // the transactions right after each one in a file
+  vector<long> before; // how many files have a transaction right before it
+  for(int db = 0; db < DB_COUNT; db++) {
+    string data;
+    if(!read_database(db_filenames[db], 0, UINT64_MAX, data)) {
+      cout << "Can't read " << db_filenames[db] << endl;
+      return false;
+    }
+    map<long, long> runs; // transactions so far of each pid * DB_COUNT + system
+    long previous = -1;
+    for(size_t pos = 0; pos < data.size(); ) {
+      size_t end = data.find('\n', pos);
+      if(end == string::npos) end = data.size();
+      string line = data.substr(pos, end - pos);
+      pos = end + 1;
+      size_t paren = line.rfind(" (pid:");
+      if(line.compare(0, 14, "Being used by ") != 0 || paren == string::npos) continue;
+      int system = system_index(line.substr(14, paren - 14));
+      if(system == -1) continue;
+      long key = atol(line.c_str() + paren + 6) * DB_COUNT + system;
+      pair<long, long> txn(key, runs[key]++);
+      if(ids.find(txn) == ids.end()) {
+        ids[txn] = systems.size();
+        systems.push_back(system);
+        after.push_back(vector<long>());
+        before.push_back(0);
+      }
+      long id = ids[txn];
+      if(previous != -1) {
+        after[previous].push_back(id);
+        before[id]++;
+      }
+      previous = id;
+    }
+  }
+
+  // topological order, taking the first one found whenever there is a choice
+  set<long> ready;
+  vector<long> order;
+  for(size_t id = 0; id < systems.size(); id++) if(before[id] == 0) ready.insert(id);
+  while(!ready.empty()) {
+    long id = *ready.begin();
+    ready.erase(ready.begin());
+    order.push_back(id);
+    for(size_t k = 0; k < after[id].size(); k++) {
+      if(--before[after[id][k]] == 0) ready.insert(after[id][k]);
+    }
+  }
+  if(order.size() < systems.size()) {
+    // the files disagree (eg. pids were reused): the rest goes at the end
+    cout << "Warning: " << systems.size() - order.size() << " transactions could not be ordered" << endl;
+    for(size_t id = 0; id < systems.size(); id++) if(before[id] > 0) order.push_back(id);
+  }
+
+  ofstream out(filename);
+  out << "# arrival_usec hold_usec system, reconstructed from the database files" << endl;
+  long per_system[DB_COUNT] = { 0 };
+  for(size_t k = 0; k < order.size(); k++) {
+    out << k * arrival_usec << " " << work_usec << " " << systems[order[k]] << endl;
+    per_system[systems[order[k]]]++;
+  }
+  out.close();
+  cout << "Wrote " << order.size() << " transactions to " << filename << endl;
+  for(int system = 0; system < DB_COUNT; system++) {
+    cout << "  " << topology[system].name << ": " << per_system[system] << endl;
+  }
+  return true;
+}
+
+// The index of a system from its name, or -1
+int system_index(const string & name) {
+  for(int system = 0; system < DB_COUNT; system++) {
+    if(name == topology[system].name) return system;
+  }
+  return -1;
+}
+
+// Checks the records of every database file (across its segments) after a
+// run: that each one is a whole record of a system that uses the database,
+// that the file ends with one, that every "Being used by" record has its
+// "Free from the" record and the other way round, and that no other locked
+// record comes between the two. The last can happen by design with striped
+// and record locks, so with --allow-overlap it is only reported, unless the
+// two are of the same system: those locks are keyed by system, and its
+// transactions exclude each other whatever the locking. Records appended by single-record transactions may come anywhere. The replicas
+// of a database left by --replicas must hold exactly what it holds. With
+// --partitions, every partition file is checked on its own.
+// Returns whether all the files passed.
+bool audit_databases() {
+  const char * heads[3] = { "Being used by ", "Free from the ", "Appended by " };
+  const char * tails[3] = { " (pid:", " (pid: ", " (pid: " };
+  bool passed = true;
+  int parts = partition_count > 0 ? partition_count : 1;
+  for(int file = 0; file < DB_COUNT * parts; file++) {
+    int db = file / parts;
+    string name = partition_count > 0 ? partition_path(db, file % parts) : db_filenames[db];
+    string data;
+    if(!read_database(name.c_str(), 0, UINT64_MAX, data)) {
+      cout << "Can't read " << name << endl;
+      return false;
+    }
+    long records = 0, appends = 0, inside = 0, malformed = 0, unmatched = 0, overlapping = 0, same_key = 0;
+    map<long, long> open; // pid * DB_COUNT + system of the locked transactions in progress
+    for(size_t pos = 0; pos < data.size(); ) {
+      size_t end = data.find('\n', pos);
+      if(end == string::npos) {
+        malformed++; // a record cut short at the end of the file
+        break;
+      }
+      string line = data.substr(pos, end - pos);
+      pos = end + 1;
+      records++;
+
+      // <head><system name><tail><pid>)
+      int kind = -1;
+      for(int k = 0; k < 3 && kind == -1; k++) {
+        if(line.compare(0, strlen(heads[k]), heads[k]) == 0) kind = k;
+      }
+      size_t paren = kind == -1 ? string::npos : line.rfind(tails[kind]);
+      int system = paren == string::npos ? -1 : system_index(line.substr(strlen(heads[kind]), paren - strlen(heads[kind])));
+      size_t digits = paren == string::npos ? 0 : paren + strlen(tails[kind]);
+      bool whole = system != -1 && line.size() > digits + 1 && line[line.size() - 1] == ')' &&
+                   line.find_first_not_of("0123456789", digits) == line.size() - 1;
+      bool uses = system != -1 && (topology[system].db1 == db || (kind != 2 && topology[system].db2 == db));
+      if(!whole || !uses) {
+        malformed++;
+        if(debug) cout << name << ": malformed record \"" << line << "\"" << endl;
+        continue;
+      }
+
+      long key = atol(line.c_str() + digits) * DB_COUNT + system;
+      if(kind == 2) {
+        appends++;
+        if(!open.empty()) inside++;
+      }
+      else if(kind == 0) {
+        if(!open.empty()) overlapping++;
+        for(map<long, long>::iterator it = open.begin(); it != open.end(); it++) {
+          if(it->first % DB_COUNT == system) same_key++;
+        }
+        if(open[key]++ > 0) unmatched++; // used again before it was freed
+      }
+      else if(open.find(key) == open.end()) {
+        unmatched++; // freed, but never used
+      }
+      else {
+        if(open.size() > 1) overlapping++;
+        if(--open[key] == 0) open.erase(key);
+      }
+    }
+    for(map<long, long>::iterator it = open.begin(); it != open.end(); it++) unmatched += it->second;
+
+    cout << name << ": " << records << " records, " << appends << " appended without locks ("
+         << inside << " inside a locked transaction), " << malformed << " malformed, " << unmatched
+         << " unmatched, " << overlapping << " overlapping locked records (" << same_key << " of the same system)" << endl;
+    if(malformed > 0 || unmatched > 0 || same_key > 0 || (overlapping > 0 && !allow_overlap)) passed = false;
+
+    // a replica holds the same transactions in the same order
+    struct stat st;
+    for(int k = 0; k < MAX_REPLICAS && partition_count == 0 && stat(replica_name(db, k).c_str(), &st) == 0; k++) {
+      string replica;
+      if(!read_database(replica_name(db, k).c_str(), 0, UINT64_MAX, replica)) replica.clear();
+      size_t same = 0;
+      while(same < data.size() && same < replica.size() && data[same] == replica[same]) same++;
+      if(same == data.size() && same == replica.size()) {
+        cout << "  " << replica_name(db, k) << " matches" << endl;
+      }
+      else {
+        cout << "  " << replica_name(db, k) << " differs from byte " << same << endl;
+        passed = false;
+      }
+    }
+  }
+  cout << (passed ? "Audit passed" : "Audit FAILED") << endl;
+  return passed;
+}
+
+// Reads a trace (see trace_entry) into trace
+bool load_trace(const char * filename) {
+  ifstream in(filename);
+  if(!in) return false;
+  string line;
+  long capacity = 0;
+  while(getline(in, line)) {
+    struct trace_entry entry;
+    if(line.empty() || line[0] == '#') continue;
+    if(sscanf(line.c_str(), "%" SCNu64 " %ld %d", &entry.arrival_usec, &entry.hold_usec, &entry.system) != 3 ||
+       entry.system < 0 || entry.system >= DB_COUNT) {
+      cout << "Bad line in " << filename << ": " << line << endl;
+      return false;
+    }
+    if(trace_count == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      trace = (struct trace_entry *) realloc(trace, sizeof(struct trace_entry) * capacity);
+    }
+    trace[trace_count++] = entry;
+  }
+  return trace_count > 0;
+}
+
+// Spin lock for short critical sections on shared memory
+void spin_lock(bool * lock) {
+  while(__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+void spin_unlock(bool * lock) {
+  __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+// Prints out the value of a semaphore to the standard output
+void print_sem_val(int semSet, int semid) {
+  int semVal = semctl(semSet, semid, GETVAL, 0);
+  cout << "Semaphore " << semid << " value: " << semVal << endl;
+}
+
+// Initialize all the semaphores of the set at once, with one value each
+void init_all_sems(int semSet, unsigned short * values) {
+  union semun sem_init;
+  sem_init.array = values;
+  semctl(semSet, 0, SETALL, sem_init);
+}
+
+// Initialize a semaphore with an integer value
+// In the case of this application we set the value
+// of the semaphore to 1 (for a binary semaphore)
+void init_sem(int semSet, int semid, int value) {
+  union semun sem_init;
+  sem_init.val = value;
+  semctl(semSet, semid, SETVAL, sem_init);
+}
+
+// Acquire the semaphore and print out its value
+// This essentially decreases the value of the semaphore by 1
+void acquire_resource(int semSet, int semid) {
+  if(debug) {
+    cout << "Acquiring semaphore " << semid << endl;
+    print_sem_val(semSet, semid);
+  }
+
+  struct sembuf sem;
+  sem.sem_num = semid;
+  sem.sem_flg = SEM_UNDO;
+  sem.sem_op = -1;
+  if(events != NULL && semid < SEM_COUNT) event_acquire(semSet, semid, false);
+  // a timer wakeup meant for an earlier wait must not cut this one short
+  else while(logged_semop(semSet,&sem,1) == -1 && errno == EINTR);
+
+  if(debug) {
+    cout << "Semaphore " << semid << " acquired!" << endl;
+    print_sem_val(semSet, semid);
+  }
+}
+
+// Release the semaphore and print out its value
+// This essentially increase the value of the semaphore by 1
+void release_resource(int semSet, int semid) {
+  if(debug) {
+    cout << "Releasing semaphore " << semid << endl;
+    print_sem_val(semSet, semid);
+  }
+  struct sembuf sem;
+  sem.sem_num = semid;
+  sem.sem_flg = SEM_UNDO;
+  sem.sem_op = 1;
+  logged_semop(semSet,&sem,1);
+  if(events != NULL && semid < SEM_COUNT) notify_waiter(semid);
+  if(debug) {
+    cout << "Semaphore " << semid << " released!" << endl;
+    print_sem_val(semSet, semid);
+  }
+}
+
+// Returns the id of a shared memory space of the given size in bytes
+// Use get_pointer_to_mem to get a memory address
+int create_shared_mem_id(size_t size) {
+  int shmId;
+  if((shmId = shmget(IPC_PRIVATE, size,SHM_MODE)) == -1) {
+    perror("shmget error");
+    return -1;
+  }
+  else {
+    if(debug) cout << "Shared memory created with id: " << shmId << endl;
+    return shmId;
+  }
+}
+
+// Attaches shared memory id to a physical address
+// Must pass in the shared memory id
+int * get_pointer_to_mem(int shmId) {
+  int * sharedVar;
+  sharedVar = (int *) shmat(shmId,0,0);
+  if(sharedVar == (int *) -1) {
+    perror("shmat error");
+    return NULL;
+  }
+  else {
+    if(debug) cout << "Starting address of shared variable is: " << sharedVar << endl;
+    return sharedVar;
+  }
+}
+
+// Frees the memory segment associated with that shared memory ID
+// This allows this memory to be re-allocated to other processes later
+int destroy_mem_segment(int shmId) {
+  if(shmctl(shmId,IPC_RMID, (struct shmid_ds *) 0 ) < 0) {
+    perror("can't destroy segment");
+    return -1;
+  }
+  return 0;
+}
+
+// Creates a set of semaphores of a size of the integer passed
+// In this example we pass it a value of 5 to create 5 semaphores
+int create_semaphore_set(int num_of_sems) {
+  return semget(IPC_PRIVATE, num_of_sems, IPC_CREAT | SEM_MODE);
+}